@@ -0,0 +1,72 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+static arena_chunk_t* new_chunk(size_t size, arena_chunk_t* next) {
+    if (size < ARENA_MIN_CHUNK_SIZE) size = ARENA_MIN_CHUNK_SIZE;
+    arena_chunk_t* chunk = malloc(sizeof(arena_chunk_t));
+    chunk->next = next;
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->data = malloc(size);
+    return chunk;
+}
+
+/// @brief allocate size bytes, aligned to ARENA_ALIGNMENT, valid until the
+/// next arena_reset. When the chunk is full a new one at least twice as
+/// large is added, so earlier allocations never move
+void* arena_alloc(arena_t* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    arena_chunk_t* chunk = arena->chunk;
+    if (chunk == NULL || chunk->used + size > chunk->size) {
+        size_t chunk_size = chunk ? chunk->size * 2 : 0;
+        if (chunk_size < size) chunk_size = size;
+        chunk = arena->chunk = new_chunk(chunk_size, chunk);
+    }
+    void* memory = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->used += size;
+    return memory;
+}
+
+/// @brief release every allocation at once. An arena that needed several
+/// chunks is remade as one chunk as large as all of them, so once frames
+/// stop growing a reset only rewinds a counter
+void arena_reset(arena_t* arena) {
+    arena_chunk_t* chunk = arena->chunk;
+    if (chunk != NULL && chunk->next != NULL) {
+        size_t total = 0;
+        while (chunk != NULL) {
+            arena_chunk_t* next = chunk->next;
+            total += chunk->size;
+            free(chunk->data);
+            free(chunk);
+            chunk = next;
+        }
+        arena->chunk = new_chunk(total, NULL);
+    } else if (chunk != NULL) {
+        chunk->used = 0;
+    }
+    arena->used = 0;
+}
+
+/// @brief bytes held by the arena's chunks
+size_t arena_get_size(const arena_t* arena) {
+    size_t size = 0;
+    for (arena_chunk_t* chunk = arena->chunk; chunk; chunk = chunk->next) {
+        size += chunk->size;
+    }
+    return size;
+}
+
+void arena_free(arena_t* arena) {
+    arena_chunk_t* chunk = arena->chunk;
+    while (chunk != NULL) {
+        arena_chunk_t* next = chunk->next;
+        free(chunk->data);
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunk = NULL;
+    arena->used = 0;
+}
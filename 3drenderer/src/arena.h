@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Smallest chunk an arena allocates, so small frames never grow it twice
+#define ARENA_MIN_CHUNK_SIZE (64 * 1024)
+
+// Allocations are rounded up to this many bytes, enough for any type the
+// pipeline stores
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_chunk_t {
+    struct arena_chunk_t* next;  // the chunk filled before this one
+    size_t size;                 // bytes of data
+    size_t used;
+    unsigned char* data;
+} arena_chunk_t;
+
+// Linear allocator for data that lives for one frame: allocations bump a
+// pointer and are all released at once by arena_reset
+typedef struct {
+    arena_chunk_t* chunk;  // the chunk allocated from, newest first
+    size_t used;           // bytes allocated since the last reset
+} arena_t;
+
+void* arena_alloc(arena_t* arena, size_t size);
+void arena_reset(arena_t* arena);
+size_t arena_get_size(const arena_t* arena);
+void arena_free(arena_t* arena);
+
+#endif
@@ -0,0 +1,390 @@
+#include "bvh.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "array.h"
+#include "mesh.h"
+
+// What the tree knows of a mesh
+typedef struct {
+    bounds_t bounds;  // world-space bounds
+    int leaf;         // node holding the mesh
+    int draw_rank;    // place in the order compare_assets puts meshes in
+} bvh_instance_t;
+
+static bvh_node_t* nodes = NULL;           // root first, children after
+static int* mesh_indices = NULL;           // mesh indices grouped by leaf
+static bvh_instance_t* instances = NULL;   // one per mesh, by mesh index
+static int* visible_meshes = NULL;         // result of get_visible_meshes
+static vec3_t* world_vertices = NULL;      // scratch for ray tests
+static int num_nodes_visited = 0;
+
+static bounds_t merge_bounds(bounds_t a, bounds_t b) {
+    bounds_t bounds;
+    bounds.min = vec3_new(fmin(a.min.x, b.min.x), fmin(a.min.y, b.min.y),
+                          fmin(a.min.z, b.min.z));
+    bounds.max = vec3_new(fmax(a.max.x, b.max.x), fmax(a.max.y, b.max.y),
+                          fmax(a.max.z, b.max.z));
+    return bounds;
+}
+
+// Sphere around the box, for bounds built up by merge_bounds
+static bounds_t with_bounding_sphere(bounds_t bounds) {
+    bounds.center = vec3_mul(vec3_add(bounds.min, bounds.max), 0.5);
+    bounds.radius = vec3_length(vec3_sub(bounds.max, bounds.center));
+    return bounds;
+}
+
+static bounds_t get_leaf_bounds(int first, int count) {
+    bounds_t bounds = instances[mesh_indices[first]].bounds;
+    for (int i = first + 1; i < first + count; i++) {
+        bounds = merge_bounds(bounds, instances[mesh_indices[i]].bounds);
+    }
+    return with_bounding_sphere(bounds);
+}
+
+static void update_instance(int mesh_index) {
+    mesh_t* mesh = get_mesh(mesh_index);
+    mat4_t world_matrix =
+        mat4_make_world(mesh->scale, mesh->rotation, mesh->translation);
+    instances[mesh_index].bounds =
+        transform_bounds(&world_matrix, mesh->bounds);
+}
+
+static int sort_axis = 0;
+
+static float get_centroid(int mesh_index, int axis) {
+    bounds_t bounds = instances[mesh_index].bounds;
+    float center[3] = {bounds.center.x, bounds.center.y, bounds.center.z};
+    return center[axis];
+}
+
+static int compare_centroids(const void* a, const void* b) {
+    float ca = get_centroid(*(const int*)a, sort_axis);
+    float cb = get_centroid(*(const int*)b, sort_axis);
+    return (ca > cb) - (ca < cb);
+}
+
+// Instances of the same mesh together, then in mesh order
+static int compare_assets(const void* a, const void* b) {
+    int asset_a = get_mesh(*(const int*)a)->asset;
+    int asset_b = get_mesh(*(const int*)b)->asset;
+    if (asset_a != asset_b) return asset_a - asset_b;
+    return *(const int*)a - *(const int*)b;
+}
+
+// Same order from the ranks compare_assets gave the meshes at build time
+static int compare_draw_ranks(const void* a, const void* b) {
+    return instances[*(const int*)a].draw_rank -
+           instances[*(const int*)b].draw_rank;
+}
+
+// Fill nodes[node_index] with the meshes first to first + count, splitting
+// them at the median centroid along the axis the centroids spread most
+static void build_node(int node_index, int first, int count) {
+    nodes[node_index].bounds = get_leaf_bounds(first, count);
+    nodes[node_index].is_dirty = false;
+    if (count <= BVH_LEAF_SIZE) {
+        nodes[node_index].first = first;
+        nodes[node_index].count = count;
+        for (int i = first; i < first + count; i++) {
+            instances[mesh_indices[i]].leaf = node_index;
+        }
+        return;
+    }
+
+    vec3_t min = instances[mesh_indices[first]].bounds.center;
+    vec3_t max = min;
+    for (int i = first + 1; i < first + count; i++) {
+        vec3_t center = instances[mesh_indices[i]].bounds.center;
+        min = vec3_new(fmin(min.x, center.x), fmin(min.y, center.y),
+                       fmin(min.z, center.z));
+        max = vec3_new(fmax(max.x, center.x), fmax(max.y, center.y),
+                       fmax(max.z, center.z));
+    }
+    vec3_t spread = vec3_sub(max, min);
+    sort_axis = 0;
+    if (spread.y > spread.x) sort_axis = 1;
+    if (spread.z > fmax(spread.x, spread.y)) sort_axis = 2;
+    qsort(&mesh_indices[first], count, sizeof(int), compare_centroids);
+
+    // Children go next to each other; nodes may move while they are built
+    int children = array_length(nodes);
+    nodes = array_hold(nodes, 2, sizeof(bvh_node_t));
+    nodes[node_index].first = children;
+    nodes[node_index].count = 0;
+    nodes[children].parent = node_index;
+    nodes[children + 1].parent = node_index;
+    build_node(children, first, count / 2);
+    build_node(children + 1, first + count / 2, count - count / 2);
+}
+
+static void build_scene_bvh(void) {
+    int num_meshes = get_num_meshes();
+    array_clear(instances);
+    array_clear(mesh_indices);
+    array_clear(nodes);
+    if (num_meshes == 0) return;
+
+    instances = array_hold(instances, num_meshes, sizeof(bvh_instance_t));
+    mesh_indices = array_hold(mesh_indices, num_meshes, sizeof(int));
+    for (int i = 0; i < num_meshes; i++) {
+        update_instance(i);
+        mesh_indices[i] = i;
+    }
+    clear_moved_meshes();
+
+    qsort(mesh_indices, num_meshes, sizeof(int), compare_assets);
+    for (int i = 0; i < num_meshes; i++) {
+        instances[mesh_indices[i]].draw_rank = i;
+        mesh_indices[i] = i;
+    }
+    nodes = array_hold(nodes, 1, sizeof(bvh_node_t));
+    nodes[0].parent = -1;
+    build_node(0, 0, num_meshes);
+}
+
+// Refit the dirty nodes below node_index, children before their parent
+static void refit_node(int node_index) {
+    bvh_node_t* node = &nodes[node_index];
+    if (!node->is_dirty) return;
+    node->is_dirty = false;
+
+    if (node->count > 0) {
+        node->bounds = get_leaf_bounds(node->first, node->count);
+        return;
+    }
+    refit_node(node->first);
+    refit_node(node->first + 1);
+    node->bounds = with_bounding_sphere(merge_bounds(
+        nodes[node->first].bounds, nodes[node->first + 1].bounds));
+}
+
+/// @brief bring the tree up to date with the meshes: rebuilt when meshes
+/// were added, and otherwise refitted from the meshes set_mesh_transform
+/// moved up to the root. Refitting keeps the tree's topology, which stays
+/// good as long as meshes move along with their neighbours
+void update_scene_bvh(void) {
+    if (array_length(instances) != get_num_meshes()) {
+        build_scene_bvh();
+        return;
+    }
+
+    int* moved = get_moved_meshes();
+    if (array_length(moved) == 0) return;
+    for (int i = 0; i < array_length(moved); i++) {
+        update_instance(moved[i]);
+        // Ancestors of a dirty node are dirty already
+        for (int node = instances[moved[i]].leaf;
+             node >= 0 && !nodes[node].is_dirty; node = nodes[node].parent) {
+            nodes[node].is_dirty = true;
+        }
+    }
+    clear_moved_meshes();
+    refit_node(0);
+}
+
+static void add_node_meshes(int node_index) {
+    bvh_node_t* node = &nodes[node_index];
+    if (node->count == 0) {
+        add_node_meshes(node->first);
+        add_node_meshes(node->first + 1);
+        return;
+    }
+    for (int i = node->first; i < node->first + node->count; i++) {
+        array_push(visible_meshes, mesh_indices[i]);
+    }
+}
+
+static void cull_node(const frustum_t* frustum, int node_index) {
+    bvh_node_t* node = &nodes[node_index];
+    num_nodes_visited++;
+
+    int crossed_planes;
+    int outcode = get_bounds_outcode(frustum, node->bounds, &crossed_planes);
+    if (outcode & OUTCODE_VIEW_PLANES) {
+        return;
+    }
+    // Everything below a node inside the view volume is visible
+    if ((crossed_planes & OUTCODE_VIEW_PLANES) == 0) {
+        add_node_meshes(node_index);
+        return;
+    }
+
+    if (node->count == 0) {
+        cull_node(frustum, node->first);
+        cull_node(frustum, node->first + 1);
+        return;
+    }
+    for (int i = node->first; i < node->first + node->count; i++) {
+        outcode = get_bounds_outcode(
+            frustum, instances[mesh_indices[i]].bounds, &crossed_planes);
+        if ((outcode & OUTCODE_VIEW_PLANES) == 0) {
+            array_push(visible_meshes, mesh_indices[i]);
+        }
+    }
+}
+
+/// @brief indices of the meshes whose world bounds are not outside the view
+/// volume of view_proj_matrix, instances of a mesh next to each other and in
+/// mesh order otherwise. The array is owned by the tree and valid until the
+/// next call; its size is array_length
+int* get_visible_meshes(const mat4_t* view_proj_matrix) {
+    array_clear(visible_meshes);
+    num_nodes_visited = 0;
+    if (array_length(nodes) > 0) {
+        frustum_t frustum = make_frustum(view_proj_matrix);
+        cull_node(&frustum, 0);
+    }
+    // The walk finds meshes in spatial order. Meshes keep being drawn in
+    // the order they were loaded, each with its instances right after it
+    qsort(visible_meshes, array_length(visible_meshes), sizeof(int),
+          compare_draw_ranks);
+    return visible_meshes;
+}
+
+// Slab test: distance along the ray where it enters the box, or FLT_MAX
+static float ray_box_distance(vec3_t origin, vec3_t inverse_direction,
+                              bounds_t bounds) {
+    float t1 = (bounds.min.x - origin.x) * inverse_direction.x;
+    float t2 = (bounds.max.x - origin.x) * inverse_direction.x;
+    float t_enter = fmin(t1, t2);
+    float t_exit = fmax(t1, t2);
+    t1 = (bounds.min.y - origin.y) * inverse_direction.y;
+    t2 = (bounds.max.y - origin.y) * inverse_direction.y;
+    t_enter = fmax(t_enter, fmin(t1, t2));
+    t_exit = fmin(t_exit, fmax(t1, t2));
+    t1 = (bounds.min.z - origin.z) * inverse_direction.z;
+    t2 = (bounds.max.z - origin.z) * inverse_direction.z;
+    t_enter = fmax(t_enter, fmin(t1, t2));
+    t_exit = fmin(t_exit, fmax(t1, t2));
+
+    if (t_exit < fmax(t_enter, 0)) return FLT_MAX;
+    return fmax(t_enter, 0);
+}
+
+// Moller-Trumbore: distance along the ray to the triangle, or FLT_MAX
+static float ray_triangle_distance(vec3_t origin, vec3_t direction, vec3_t a,
+                                   vec3_t b, vec3_t c) {
+    vec3_t ab = vec3_sub(b, a);
+    vec3_t ac = vec3_sub(c, a);
+    vec3_t p = vec3_cross(direction, ac);
+    float det = vec3_dot(ab, p);
+    if (fabs(det) < 1e-12) return FLT_MAX;
+
+    float inverse_det = 1.0 / det;
+    vec3_t s = vec3_sub(origin, a);
+    float u = vec3_dot(s, p) * inverse_det;
+    if (u < 0 || u > 1) return FLT_MAX;
+    vec3_t q = vec3_cross(s, ab);
+    float v = vec3_dot(direction, q) * inverse_det;
+    if (v < 0 || u + v > 1) return FLT_MAX;
+
+    float t = vec3_dot(ac, q) * inverse_det;
+    return t >= 0 ? t : FLT_MAX;
+}
+
+static float ray_mesh_distance(int mesh_index, vec3_t origin,
+                               vec3_t direction) {
+    mesh_t* mesh = get_mesh(mesh_index);
+    mat4_t world_matrix =
+        mat4_make_world(mesh->scale, mesh->rotation, mesh->translation);
+    int num_vertices = array_length(mesh->vertices);
+    array_clear(world_vertices);
+    world_vertices = array_hold(world_vertices, num_vertices, sizeof(vec3_t));
+    for (int i = 0; i < num_vertices; i++) {
+        world_vertices[i] = vec3_from_vec4(
+            mat4_mul_vec4(world_matrix, vec4_from_vec3(mesh->vertices[i])));
+    }
+
+    // Against the full mesh, not its coarser levels of detail
+    float nearest = FLT_MAX;
+    for (int i = 0; i < mesh->lods[0].num_faces; i++) {
+        face_t face = mesh->faces[i];
+        nearest = fmin(nearest, ray_triangle_distance(
+                                    origin, direction, world_vertices[face.a],
+                                    world_vertices[face.b],
+                                    world_vertices[face.c]));
+    }
+    return nearest;
+}
+
+static void raycast_node(int node_index, vec3_t origin, vec3_t direction,
+                         vec3_t inverse_direction, int* hit, float* nearest) {
+    bvh_node_t* node = &nodes[node_index];
+    num_nodes_visited++;
+
+    if (node->count > 0) {
+        for (int i = node->first; i < node->first + node->count; i++) {
+            int mesh_index = mesh_indices[i];
+            bounds_t bounds = instances[mesh_index].bounds;
+            if (ray_box_distance(origin, inverse_direction, bounds) >=
+                *nearest) {
+                continue;
+            }
+            float distance = ray_mesh_distance(mesh_index, origin, direction);
+            if (distance < *nearest) {
+                *nearest = distance;
+                *hit = mesh_index;
+            }
+        }
+        return;
+    }
+
+    // Nearer child first, so the hit found there can prune the other one
+    int children[2] = {node->first, node->first + 1};
+    float distances[2];
+    for (int i = 0; i < 2; i++) {
+        distances[i] = ray_box_distance(origin, inverse_direction,
+                                        nodes[children[i]].bounds);
+    }
+    if (distances[1] < distances[0]) {
+        int child = children[0];
+        children[0] = children[1];
+        children[1] = child;
+        float distance = distances[0];
+        distances[0] = distances[1];
+        distances[1] = distance;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (distances[i] < *nearest) {
+            raycast_node(children[i], origin, direction, inverse_direction,
+                         hit, nearest);
+        }
+    }
+}
+
+/// @brief nearest mesh whose triangles the world-space ray hits, or -1.
+/// The distance along the ray is in units of the direction's length
+int raycast_scene(vec3_t origin, vec3_t direction, float* distance) {
+    int hit = -1;
+    float nearest = FLT_MAX;
+    num_nodes_visited = 0;
+    vec3_t inverse_direction = {1.0 / direction.x, 1.0 / direction.y,
+                                1.0 / direction.z};
+    if (array_length(nodes) > 0 &&
+        ray_box_distance(origin, inverse_direction, nodes[0].bounds) <
+            FLT_MAX) {
+        raycast_node(0, origin, direction, inverse_direction, &hit, &nearest);
+    }
+    *distance = nearest;
+    return hit;
+}
+
+/// @brief nodes the last query walked, to compare against the mesh count
+int get_num_bvh_nodes_visited(void) { return num_nodes_visited; }
+
+void free_scene_bvh(void) {
+    array_free(nodes);
+    array_free(mesh_indices);
+    array_free(instances);
+    array_free(visible_meshes);
+    array_free(world_vertices);
+    nodes = NULL;
+    mesh_indices = NULL;
+    instances = NULL;
+    visible_meshes = NULL;
+    world_vertices = NULL;
+}
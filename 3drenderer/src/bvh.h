@@ -0,0 +1,29 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "clipping.h"
+#include "matrix.h"
+#include "vector.h"
+
+// Meshes per leaf; more makes a shallower tree with more bounds tests at the
+// bottom
+#define BVH_LEAF_SIZE 4
+
+// Node of the bounding volume hierarchy over the meshes of the scene. Inner
+// nodes keep their two children next to each other at first and first + 1,
+// leaves a run of count entries in the mesh index list starting at first
+typedef struct {
+    bounds_t bounds;  // world-space bounds of every mesh below
+    int first;        // first child, or first mesh index entry of a leaf
+    int count;        // number of meshes of a leaf, 0 for inner nodes
+    int parent;       // -1 for the root
+    bool is_dirty;    // a mesh below moved since the last refit
+} bvh_node_t;
+
+void update_scene_bvh(void);
+int* get_visible_meshes(const mat4_t* view_proj_matrix);
+int raycast_scene(vec3_t origin, vec3_t direction, float* distance);
+int get_num_bvh_nodes_visited(void);
+void free_scene_bvh(void);
+
+#endif
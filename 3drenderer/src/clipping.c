@@ -1,14 +1,205 @@
 #include "clipping.h"
 
 #include <math.h>
-#include <stdio.h>
 
-#define NUM_PLANES 6
-plane_t frustum_planes[NUM_PLANES];
+#include "rasterizer.h"
+
+// With the guard band, triangles crossing the side planes are left to the
+// rasterizer, which scissors them per pixel, unless they reach past the guard
+// band. Only near/far and guard band crossings split polygons
+static bool guard_band_enabled = true;
+static float guard_band_x = 1.0;  // guard band half width over the screen's
+static float guard_band_y = 1.0;  // guard band half height over the screen's
 
 float float_lerp(float a, float b, float t) { return a + t * (b - a); }
 
-polygon_t create_polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2,
+// Signed distance of a clip-space vertex to a plane of the view volume, up to
+// a positive factor, positive on the inside
+static float plane_distance(vec4_t v, int plane) {
+    switch (plane) {
+        case LEFT_FRUSTUM_PLANE:
+            return v.w + v.x;
+        case RIGHT_FRUSTUM_PLANE:
+            return v.w - v.x;
+        case TOP_FRUSTUM_PLANE:
+            return v.w - v.y;
+        case BOTTOM_FRUSTUM_PLANE:
+            return v.w + v.y;
+        case NEAR_FRUSTUM_PLANE:
+            return v.z;
+        case FAR_FRUSTUM_PLANE:
+            return v.w - v.z;
+        case LEFT_GUARD_PLANE:
+            return guard_band_x * v.w + v.x;
+        case RIGHT_GUARD_PLANE:
+            return guard_band_x * v.w - v.x;
+        case TOP_GUARD_PLANE:
+            return guard_band_y * v.w - v.y;
+        default:
+            return guard_band_y * v.w + v.y;
+    }
+}
+
+/// @brief size the guard band for a viewport: a triangle inside it spans
+/// less than MAX_RASTER_EXTENT pixels, or the viewport when that is larger,
+/// which the tiles rasterize without dropping it, see tile.c
+void init_guard_band(int width, int height) {
+    // A pixel of slack for the subpixel snapping
+    float extent = MAX_RASTER_EXTENT - 1;
+    guard_band_x = fmax(extent / width, 1.0);
+    guard_band_y = fmax(extent / height, 1.0);
+}
+
+void set_guard_band(bool enabled) { guard_band_enabled = enabled; }
+bool is_guard_band_enabled(void) { return guard_band_enabled; }
+
+/// @brief planes a triangle must be clipped against, given the or of its
+/// vertices' outcodes
+int get_clip_planes(int outcodes) {
+    if (!guard_band_enabled) {
+        return outcodes & OUTCODE_VIEW_PLANES;
+    }
+    int clip_planes = OUTCODE(NEAR_FRUSTUM_PLANE) | OUTCODE(FAR_FRUSTUM_PLANE) |
+                      OUTCODE(LEFT_GUARD_PLANE) | OUTCODE(RIGHT_GUARD_PLANE) |
+                      OUTCODE(TOP_GUARD_PLANE) | OUTCODE(BOTTOM_GUARD_PLANE);
+    return outcodes & clip_planes;
+}
+
+/// @brief bit mask of the planes the clip-space vertex is outside of. A
+/// triangle whose vertices share a view plane bit is invisible, see
+/// get_clip_planes for the bits that call for clipping
+int get_clip_outcode(vec4_t v) {
+    // Same tests as plane_distance(v, plane) < 0, spelled out since this
+    // runs for every vertex of every mesh
+    float guard_x = guard_band_x * v.w;
+    float guard_y = guard_band_y * v.w;
+    int outcode = 0;
+    if (v.x < -v.w) outcode |= OUTCODE(LEFT_FRUSTUM_PLANE);
+    if (v.x > v.w) outcode |= OUTCODE(RIGHT_FRUSTUM_PLANE);
+    if (v.y > v.w) outcode |= OUTCODE(TOP_FRUSTUM_PLANE);
+    if (v.y < -v.w) outcode |= OUTCODE(BOTTOM_FRUSTUM_PLANE);
+    if (v.z < 0) outcode |= OUTCODE(NEAR_FRUSTUM_PLANE);
+    if (v.z > v.w) outcode |= OUTCODE(FAR_FRUSTUM_PLANE);
+    if (v.x < -guard_x) outcode |= OUTCODE(LEFT_GUARD_PLANE);
+    if (v.x > guard_x) outcode |= OUTCODE(RIGHT_GUARD_PLANE);
+    if (v.y > guard_y) outcode |= OUTCODE(TOP_GUARD_PLANE);
+    if (v.y < -guard_y) outcode |= OUTCODE(BOTTOM_GUARD_PLANE);
+    return outcode;
+}
+
+/// @brief box and sphere bounding the points; the sphere is centered on the
+/// box, which is looser than the tightest sphere but cheap and stable
+bounds_t make_bounds(const vec3_t* points, int num_points) {
+    bounds_t bounds = {0};
+    if (num_points == 0) return bounds;
+
+    bounds.min = points[0];
+    bounds.max = points[0];
+    for (int i = 1; i < num_points; i++) {
+        bounds.min.x = fmin(bounds.min.x, points[i].x);
+        bounds.min.y = fmin(bounds.min.y, points[i].y);
+        bounds.min.z = fmin(bounds.min.z, points[i].z);
+        bounds.max.x = fmax(bounds.max.x, points[i].x);
+        bounds.max.y = fmax(bounds.max.y, points[i].y);
+        bounds.max.z = fmax(bounds.max.z, points[i].z);
+    }
+    bounds.center = vec3_mul(vec3_add(bounds.min, bounds.max), 0.5);
+    for (int i = 0; i < num_points; i++) {
+        float distance = vec3_length(vec3_sub(points[i], bounds.center));
+        bounds.radius = fmax(bounds.radius, distance);
+    }
+    return bounds;
+}
+
+/// @brief box around the bounds after an affine transform, with the sphere
+/// around that box
+bounds_t transform_bounds(const mat4_t* m, bounds_t bounds) {
+    vec3_t center = vec3_mul(vec3_add(bounds.min, bounds.max), 0.5);
+    vec3_t extent = vec3_mul(vec3_sub(bounds.max, bounds.min), 0.5);
+
+    // Each new half extent sums the old ones weighed by the absolute matrix
+    float c[3] = {center.x, center.y, center.z};
+    float e[3] = {extent.x, extent.y, extent.z};
+    float new_c[3];
+    float new_e[3];
+    for (int i = 0; i < 3; i++) {
+        new_c[i] = m->m[i][3];
+        new_e[i] = 0;
+        for (int j = 0; j < 3; j++) {
+            new_c[i] += m->m[i][j] * c[j];
+            new_e[i] += fabs(m->m[i][j]) * e[j];
+        }
+    }
+
+    bounds_t result;
+    result.center = vec3_new(new_c[0], new_c[1], new_c[2]);
+    vec3_t new_extent = vec3_new(new_e[0], new_e[1], new_e[2]);
+    result.min = vec3_sub(result.center, new_extent);
+    result.max = vec3_add(result.center, new_extent);
+    result.radius = vec3_length(new_extent);
+    return result;
+}
+
+/// @brief the clip planes in the space mvp takes to clip space
+frustum_t make_frustum(const mat4_t* mvp) {
+    // plane_distance is linear, so applied to the matrix columns it gives
+    // the plane's coefficients in the matrix's input space
+    vec4_t columns[4];
+    for (int j = 0; j < 4; j++) {
+        columns[j] = (vec4_t){mvp->m[0][j], mvp->m[1][j], mvp->m[2][j],
+                              mvp->m[3][j]};
+    }
+
+    frustum_t frustum;
+    for (int plane = 0; plane < NUM_CLIP_PLANES; plane++) {
+        frustum.normals[plane] = (vec3_t){plane_distance(columns[0], plane),
+                                          plane_distance(columns[1], plane),
+                                          plane_distance(columns[2], plane)};
+        frustum.offsets[plane] = plane_distance(columns[3], plane);
+        frustum.normal_lengths[plane] = vec3_length(frustum.normals[plane]);
+    }
+    return frustum;
+}
+
+/// @brief test bounds against the clip planes of a frustum in their space.
+/// Returns the mask of planes the bounds are entirely outside of, the same
+/// way get_clip_outcode does for a vertex, and stores in crossed the planes
+/// the bounds straddle. The sphere settles most planes, the box the rest
+int get_bounds_outcode(const frustum_t* frustum, bounds_t bounds,
+                       int* crossed) {
+    int outcode = 0;
+    *crossed = 0;
+    for (int plane = 0; plane < NUM_CLIP_PLANES; plane++) {
+        vec3_t normal = frustum->normals[plane];
+        float offset = frustum->offsets[plane];
+
+        float center_distance = vec3_dot(normal, bounds.center) + offset;
+        float radius = bounds.radius * frustum->normal_lengths[plane];
+        if (center_distance >= radius) continue;
+        if (center_distance < -radius) {
+            outcode |= OUTCODE(plane);
+            continue;
+        }
+
+        // Box corners nearest to and furthest along the plane normal
+        float max_distance = offset;
+        float min_distance = offset;
+        max_distance += fmax(normal.x * bounds.min.x, normal.x * bounds.max.x);
+        max_distance += fmax(normal.y * bounds.min.y, normal.y * bounds.max.y);
+        max_distance += fmax(normal.z * bounds.min.z, normal.z * bounds.max.z);
+        min_distance += fmin(normal.x * bounds.min.x, normal.x * bounds.max.x);
+        min_distance += fmin(normal.y * bounds.min.y, normal.y * bounds.max.y);
+        min_distance += fmin(normal.z * bounds.min.z, normal.z * bounds.max.z);
+        if (max_distance < 0) {
+            outcode |= OUTCODE(plane);
+        } else if (min_distance < 0) {
+            *crossed |= OUTCODE(plane);
+        }
+    }
+    return outcode;
+}
+
+polygon_t create_polygon_from_triangle(vec4_t v0, vec4_t v1, vec4_t v2,
                                        tex2_t t0, tex2_t t1, tex2_t t2) {
     polygon_t polygon = {
         .vertices = {v0, v1, v2}, .texcoords = {t0, t1, t2}, .num_vertices = 3};
@@ -22,9 +213,9 @@ void triangles_from_polygon(polygon_t* polygon, triangle_t triangles[],
         int index1 = i + 1;
         int index2 = i + 2;
 
-        triangles[i].points[0] = vec4_from_vec3(polygon->vertices[index0]);
-        triangles[i].points[1] = vec4_from_vec3(polygon->vertices[index1]);
-        triangles[i].points[2] = vec4_from_vec3(polygon->vertices[index2]);
+        triangles[i].points[0] = polygon->vertices[index0];
+        triangles[i].points[1] = polygon->vertices[index1];
+        triangles[i].points[2] = polygon->vertices[index2];
 
         triangles[i].texcoords[0] = polygon->texcoords[index0];
         triangles[i].texcoords[1] = polygon->texcoords[index1];
@@ -33,178 +224,83 @@ void triangles_from_polygon(polygon_t* polygon, triangle_t triangles[],
     *num_triangles = polygon->num_vertices - 2;
 }
 
-void clip_polygon(polygon_t* polygon) {
-    clip_polygon_against_plane(polygon, LEFT_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, RIGHT_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, TOP_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, BOTTOM_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, NEAR_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, FAR_FRUSTUM_PLANE);
+/// @brief clip the polygon against the planes whose bits are set in
+/// outcodes, usually the or of its vertices' outcodes, so planes no vertex
+/// crosses cost nothing
+void clip_polygon(polygon_t* polygon, int outcodes) {
+    for (int plane = 0; plane < NUM_CLIP_PLANES; plane++) {
+        if (outcodes & OUTCODE(plane)) {
+            clip_polygon_against_plane(polygon, plane);
+        }
+    }
 }
 
 void clip_polygon_against_plane(polygon_t* polygon, int plane) {
-    // FIX: If the polygon is already empty (fully clipped by previous planes),
+    // If the polygon is already empty (fully clipped by previous planes),
     // do nothing.
     if (polygon->num_vertices == 0) {
         return;
     }
 
-    vec3_t plane_point = frustum_planes[plane].point;
-    vec3_t plane_normal = frustum_planes[plane].normal;
-
     // The array of inside vertices that will be part of the final polygon
     // returned via parameter
-    vec3_t inside_vertices[MAX_NUM_POLY_VERTICES];
+    vec4_t inside_vertices[MAX_NUM_POLY_VERTICES];
     tex2_t inside_texcoords[MAX_NUM_POLY_VERTICES];
     int num_inside_vertices = 0;
 
-    // Start current vertex with the first polygon vertex and texture coordinate
-    vec3_t* current_vertex = &polygon->vertices[0];
-    tex2_t* current_texcoord = &polygon->texcoords[0];
-
-    // Start previous vertex with the last polygon vertex and texture coordinate
-    vec3_t* previous_vertex = &polygon->vertices[polygon->num_vertices - 1];
-    tex2_t* previous_texcoord = &polygon->texcoords[polygon->num_vertices - 1];
-
-    // start current and previous dot product
-    float current_dot = 0;
-    float previous_dot =
-        vec3_dot(vec3_sub(*previous_vertex, plane_point), plane_normal);
-
-    while (current_vertex != &polygon->vertices[polygon->num_vertices]) {
-        current_dot =
-            vec3_dot(vec3_sub(*current_vertex, plane_point), plane_normal);
-
-        if (num_inside_vertices >= MAX_NUM_POLY_VERTICES) {
-            break;
-        }
-
-        // if we change from inside to outside or vice-versa
-        if (current_dot * previous_dot < 0) {
-            // DEBUG: Check for division by zero in T calculation
-            float denom = (previous_dot - current_dot);
-            if (denom == 0.0f) {
-                // printf("[CLIPPING ERROR] Division by zero in clipping
-                // interpolation!\n"); fflush(stdout);
-                denom = 0.0001f;  // Prevent crash
-            }
-
-            float t = previous_dot / denom;
-
-            if (t < 0.0f) t = 0.0f;
-            if (t > 1.0f) t = 1.0f;
-
-            // DEBUG: Check if T is within valid range [0, 1]
-            if (t < 0.0f || t > 1.0f) {
-                // printf("[CLIPPING WARN] T is out of bounds: %f. Plane: %d\n",
-                // t, plane); fflush(stdout);
-            }
-
-            vec3_t intersection_point = {
-                .x = float_lerp(previous_vertex->x, current_vertex->x, t),
-                .y = float_lerp(previous_vertex->y, current_vertex->y, t),
-                .z = float_lerp(previous_vertex->z, current_vertex->z, t)};
-
-            tex2_t interpolated_texcoord = {
-                .u = float_lerp(previous_texcoord->u, current_texcoord->u, t),
-                .v = float_lerp(previous_texcoord->v, current_texcoord->v, t)};
-
-            if (num_inside_vertices < MAX_NUM_POLY_VERTICES) {
-                inside_vertices[num_inside_vertices] =
-                    vec3_clone(&intersection_point);
-                inside_texcoords[num_inside_vertices] =
-                    tex2_clone(&interpolated_texcoord);
-                num_inside_vertices++;
-            }
+    // Start previous vertex with the last polygon vertex
+    int previous = polygon->num_vertices - 1;
+    float previous_distance =
+        plane_distance(polygon->vertices[previous], plane);
+
+    for (int current = 0; current < polygon->num_vertices; current++) {
+        float current_distance =
+            plane_distance(polygon->vertices[current], plane);
+
+        // if we change from inside to outside or vice-versa. Clip space is
+        // linear before the perspective divide, so are the distances and the
+        // texture coordinates along the edge
+        if (current_distance * previous_distance < 0 &&
+            num_inside_vertices < MAX_NUM_POLY_VERTICES) {
+            float t =
+                previous_distance / (previous_distance - current_distance);
+
+            vec4_t* a = &polygon->vertices[previous];
+            vec4_t* b = &polygon->vertices[current];
+            vec4_t intersection_point = {
+                .x = float_lerp(a->x, b->x, t),
+                .y = float_lerp(a->y, b->y, t),
+                .z = float_lerp(a->z, b->z, t),
+                .w = float_lerp(a->w, b->w, t)};
+
+            tex2_t* ta = &polygon->texcoords[previous];
+            tex2_t* tb = &polygon->texcoords[current];
+            tex2_t interpolated_texcoord = {.u = float_lerp(ta->u, tb->u, t),
+                                            .v = float_lerp(ta->v, tb->v, t)};
+
+            inside_vertices[num_inside_vertices] = intersection_point;
+            inside_texcoords[num_inside_vertices] = interpolated_texcoord;
+            num_inside_vertices++;
         }
 
         // if current point is inside the plane
-        if (current_dot > 0) {
-            if (num_inside_vertices < MAX_NUM_POLY_VERTICES) {
-                inside_vertices[num_inside_vertices] =
-                    vec3_clone(current_vertex);
-                inside_texcoords[num_inside_vertices] =
-                    tex2_clone(current_texcoord);
-                num_inside_vertices++;
-            }
+        if (current_distance >= 0 &&
+            num_inside_vertices < MAX_NUM_POLY_VERTICES) {
+            inside_vertices[num_inside_vertices] = polygon->vertices[current];
+            inside_texcoords[num_inside_vertices] =
+                polygon->texcoords[current];
+            num_inside_vertices++;
         }
 
         // move to the next vertex
-        previous_dot = current_dot;
-        previous_vertex = current_vertex;
-        previous_texcoord = current_texcoord;
-        current_vertex++;  // pointer arithmetic
-        current_texcoord++;
+        previous_distance = current_distance;
+        previous = current;
     }
 
     // copy all the vertices from the inside_vertices into the destination
     for (int i = 0; i < num_inside_vertices; i++) {
-        polygon->vertices[i] = vec3_clone(&inside_vertices[i]);
-        polygon->texcoords[i] = tex2_clone(&inside_texcoords[i]);
+        polygon->vertices[i] = inside_vertices[i];
+        polygon->texcoords[i] = inside_texcoords[i];
     }
     polygon->num_vertices = num_inside_vertices;
 }
-
-void init_frustum_planes(float fovx, float fovy, float z_near, float z_far) {
-    float cos_half_fovx = cos(fovx / 2);
-    float sin_half_fovx = sin(fovx / 2);
-
-    float cos_half_fovy = cos(fovy / 2);
-    float sin_half_fovy = sin(fovy / 2);
-
-    frustum_planes[LEFT_FRUSTUM_PLANE].point = vec3_new(0, 0, 0);
-    frustum_planes[LEFT_FRUSTUM_PLANE].normal.x = cos_half_fovx;
-    frustum_planes[LEFT_FRUSTUM_PLANE].normal.y = 0;
-    frustum_planes[LEFT_FRUSTUM_PLANE].normal.z = sin_half_fovx;
-
-    frustum_planes[RIGHT_FRUSTUM_PLANE].point = vec3_new(0, 0, 0);
-    frustum_planes[RIGHT_FRUSTUM_PLANE].normal.x = -cos_half_fovx;
-    frustum_planes[RIGHT_FRUSTUM_PLANE].normal.y = 0;
-    frustum_planes[RIGHT_FRUSTUM_PLANE].normal.z = sin_half_fovx;
-
-    frustum_planes[TOP_FRUSTUM_PLANE].point = vec3_new(0, 0, 0);
-    frustum_planes[TOP_FRUSTUM_PLANE].normal.x = 0;
-    frustum_planes[TOP_FRUSTUM_PLANE].normal.y = -cos_half_fovy;
-    frustum_planes[TOP_FRUSTUM_PLANE].normal.z = sin_half_fovy;
-
-    frustum_planes[BOTTOM_FRUSTUM_PLANE].point = vec3_new(0, 0, 0);
-    frustum_planes[BOTTOM_FRUSTUM_PLANE].normal.x = 0;
-    frustum_planes[BOTTOM_FRUSTUM_PLANE].normal.y = cos_half_fovy;
-    frustum_planes[BOTTOM_FRUSTUM_PLANE].normal.z = sin_half_fovy;
-
-    frustum_planes[NEAR_FRUSTUM_PLANE].point = vec3_new(0, 0, z_near);
-    frustum_planes[NEAR_FRUSTUM_PLANE].normal.x = 0;
-    frustum_planes[NEAR_FRUSTUM_PLANE].normal.y = 0;
-    frustum_planes[NEAR_FRUSTUM_PLANE].normal.z = 1;
-
-    frustum_planes[FAR_FRUSTUM_PLANE].point = vec3_new(0, 0, z_far);
-    frustum_planes[FAR_FRUSTUM_PLANE].normal.x = 0;
-    frustum_planes[FAR_FRUSTUM_PLANE].normal.y = 0;
-    frustum_planes[FAR_FRUSTUM_PLANE].normal.z = -1;
-}
-
-void init_frustum_planes_ortho(float left, float right, float top, float bottom,
-                               float z_near, float z_far) {
-    // Left Plane: Pointing Right (+X)
-    frustum_planes[LEFT_FRUSTUM_PLANE].point = vec3_new(left, 0, 0);
-    frustum_planes[LEFT_FRUSTUM_PLANE].normal = vec3_new(1, 0, 0);
-
-    // Right Plane: Pointing Left (-X)
-    frustum_planes[RIGHT_FRUSTUM_PLANE].point = vec3_new(right, 0, 0);
-    frustum_planes[RIGHT_FRUSTUM_PLANE].normal = vec3_new(-1, 0, 0);
-
-    // Top Plane: Pointing Down (-Y)
-    frustum_planes[TOP_FRUSTUM_PLANE].point = vec3_new(0, top, 0);
-    frustum_planes[TOP_FRUSTUM_PLANE].normal = vec3_new(0, -1, 0);
-
-    // Bottom Plane: Pointing Up (+Y)
-    frustum_planes[BOTTOM_FRUSTUM_PLANE].point = vec3_new(0, bottom, 0);
-    frustum_planes[BOTTOM_FRUSTUM_PLANE].normal = vec3_new(0, 1, 0);
-
-    // Near/Far are the same as perspective (standard Z clipping)
-    frustum_planes[NEAR_FRUSTUM_PLANE].point = vec3_new(0, 0, z_near);
-    frustum_planes[NEAR_FRUSTUM_PLANE].normal = vec3_new(0, 0, 1);
-
-    frustum_planes[FAR_FRUSTUM_PLANE].point = vec3_new(0, 0, z_far);
-    frustum_planes[FAR_FRUSTUM_PLANE].normal = vec3_new(0, 0, -1);
-}
\ No newline at end of file
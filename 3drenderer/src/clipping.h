@@ -1,40 +1,77 @@
 #ifndef CLIPPING_H
 #define CLIPPING_H
 
+#include <stdbool.h>
+
+#include "matrix.h"
 #include "triangle.h"
 #include "vector.h"
 
 #define MAX_NUM_POLY_VERTICES 10
 #define MAX_NUM_POLY_TRIANGLES 10
 
+// Planes of the view volume in homogeneous clip space, where a vertex is
+// visible when -w <= x <= w, -w <= y <= w and 0 <= z <= w. The guard band
+// planes widen the side planes to the region the rasterizer can still take
+// without overflowing its edge functions
 enum {
     LEFT_FRUSTUM_PLANE,
     RIGHT_FRUSTUM_PLANE,
     TOP_FRUSTUM_PLANE,
     BOTTOM_FRUSTUM_PLANE,
     NEAR_FRUSTUM_PLANE,
-    FAR_FRUSTUM_PLANE
+    FAR_FRUSTUM_PLANE,
+    LEFT_GUARD_PLANE,
+    RIGHT_GUARD_PLANE,
+    TOP_GUARD_PLANE,
+    BOTTOM_GUARD_PLANE
 };
 
-typedef struct {
-    vec3_t point;
-    vec3_t normal;
-} plane_t;
+#define NUM_CLIP_PLANES 10
+
+// Outcode bit set for a vertex on the outside of the given plane
+#define OUTCODE(plane) (1 << (plane))
+
+// Vertices sharing one of these bits make the triangle invisible
+#define OUTCODE_VIEW_PLANES 0x3F
 
 typedef struct {
-    vec3_t vertices[MAX_NUM_POLY_VERTICES];
+    vec4_t vertices[MAX_NUM_POLY_VERTICES];  // clip-space positions
     tex2_t texcoords[MAX_NUM_POLY_VERTICES];
     int num_vertices;
 } polygon_t;
 
-void init_frustum_planes(float fovx, float fovy, float z_near, float z_far);
-void init_frustum_planes_ortho(float left, float right, float top, float bottom,
-                               float z_near, float z_far);
-polygon_t create_polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2,
+// Model-space bounds of a mesh, computed once at load time
+typedef struct {
+    vec3_t min;     // axis-aligned bounding box
+    vec3_t max;
+    vec3_t center;  // bounding sphere around the box center
+    float radius;
+} bounds_t;
+
+// The clip planes mapped back through a matrix to the space it transforms
+// from, so bounds in that space are tested without transforming them
+typedef struct {
+    vec3_t normals[NUM_CLIP_PLANES];
+    float offsets[NUM_CLIP_PLANES];
+    float normal_lengths[NUM_CLIP_PLANES];
+} frustum_t;
+
+void init_guard_band(int width, int height);
+void set_guard_band(bool enabled);
+bool is_guard_band_enabled(void);
+int get_clip_planes(int outcodes);
+int get_clip_outcode(vec4_t v);
+bounds_t make_bounds(const vec3_t* points, int num_points);
+bounds_t transform_bounds(const mat4_t* m, bounds_t bounds);
+frustum_t make_frustum(const mat4_t* mvp);
+int get_bounds_outcode(const frustum_t* frustum, bounds_t bounds,
+                       int* crossed);
+polygon_t create_polygon_from_triangle(vec4_t v0, vec4_t v1, vec4_t v2,
                                        tex2_t t0, tex2_t t1, tex2_t t2);
 void triangles_from_polygon(polygon_t* polygon, triangle_t triangles[],
                             int* num_triangles);
-void clip_polygon(polygon_t* polygon);
+void clip_polygon(polygon_t* polygon, int outcodes);
 void clip_polygon_against_plane(polygon_t* polygon, int plane);
 
-#endif
\ No newline at end of file
+#endif
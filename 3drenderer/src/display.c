@@ -11,6 +11,14 @@ static SDL_Renderer* renderer = NULL;
 static uint32_t* color_buffer = NULL;
 static float* z_buffer = NULL;
 
+// Per-block farthest depth. Writes only ever bring depth closer, so a stale
+// value is still safe to reject against; it is refreshed once enough pixels
+// may have been written to change it, instead of after every triangle
+static float* ztile_max = NULL;
+static int* ztile_writes = NULL;
+static int num_ztiles_x = 0;
+static int num_ztiles_y = 0;
+
 static SDL_Texture* color_buffer_texture = NULL;
 static int window_height = 600;
 static int window_width = 800;
@@ -28,6 +36,9 @@ bool should_render_textured_triangles(void) {
     return (render_method == RENDER_TEXTURED ||
             render_method == RENDER_TEXTURED_WIRE);
 }
+bool should_render_visibility_buffer(void) {
+    return render_method == RENDER_VISIBILITY_BUFFER;
+}
 bool should_render_wireframe(void) {
     return (render_method == RENDER_WIRE ||
             render_method == RENDER_WIRE_VERTEX ||
@@ -77,6 +88,11 @@ bool initialize_window(void) {
         (uint32_t*)malloc(window_width * window_height * sizeof(uint32_t));
     z_buffer = (float*)malloc(window_width * window_height * sizeof(float));
 
+    num_ztiles_x = (window_width + ZTILE_SIZE - 1) / ZTILE_SIZE;
+    num_ztiles_y = (window_height + ZTILE_SIZE - 1) / ZTILE_SIZE;
+    ztile_max = (float*)malloc(num_ztiles_x * num_ztiles_y * sizeof(float));
+    ztile_writes = (int*)malloc(num_ztiles_x * num_ztiles_y * sizeof(int));
+
     // create a buffer texture for SDL that is used to hold the color buffer
     color_buffer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
                                              SDL_TEXTUREACCESS_STREAMING,
@@ -92,6 +108,10 @@ void render_color_buffer() {
     SDL_RenderPresent(renderer);
 }
 
+// Raw buffer access for the span kernels, which do their own bounds handling
+uint32_t* get_color_buffer(void) { return color_buffer; }
+float* get_z_buffer(void) { return z_buffer; }
+
 float get_zbuffer_at(int x, int y) {
     if (x < 0 || x >= window_width || y < 0 || y >= window_height) {
         return 1.0;
@@ -105,6 +125,33 @@ void update_zbuffer_at(int x, int y, float value) {
     z_buffer[(window_width * y) + x] = value;
 }
 
+/// @brief farthest depth stored in a block of the z-buffer, recomputed first
+/// if up to a whole block worth of pixels was written since the last refresh
+float get_ztile_max(int tile_x, int tile_y) {
+    int index = tile_y * num_ztiles_x + tile_x;
+    if (ztile_writes[index] >= ZTILE_SIZE * ZTILE_SIZE) {
+        int x_start = tile_x * ZTILE_SIZE;
+        int y_start = tile_y * ZTILE_SIZE;
+        int x_end = fmin(x_start + ZTILE_SIZE, window_width);
+        int y_end = fmin(y_start + ZTILE_SIZE, window_height);
+
+        float max_depth = 0.0;
+        for (int y = y_start; y < y_end; y++) {
+            for (int x = x_start; x < x_end; x++) {
+                float depth = z_buffer[(window_width * y) + x];
+                if (depth > max_depth) max_depth = depth;
+            }
+        }
+        ztile_max[index] = max_depth;
+        ztile_writes[index] = 0;
+    }
+    return ztile_max[index];
+}
+
+void add_ztile_writes(int tile_x, int tile_y, int num_pixels) {
+    ztile_writes[tile_y * num_ztiles_x + tile_x] += num_pixels;
+}
+
 void clear_color_buffer(uint32_t color) {
     for (int i = 0, buffer_size = window_height * window_width; i < buffer_size;
          i++) {
@@ -117,6 +164,10 @@ void clear_z_buffer(void) {
          i++) {
         z_buffer[i] = 1.0;
     }
+    for (int i = 0; i < num_ztiles_x * num_ztiles_y; i++) {
+        ztile_max[i] = 1.0;
+        ztile_writes[i] = 0;
+    }
 }
 
 void draw_grid(uint32_t color, int cell_size) {
@@ -148,8 +199,8 @@ void draw_rect(int x_pos, int y_pos, int width, int height, uint32_t color) {
 }
 
 // @brief function to draw a line using the DDA algorithm
-void draw_line(int x0, int y0, float z0, float w0, int x1, int y1, float z1,
-               float w1, uint32_t color) {
+void draw_line(int x0, int y0, float w0, int x1, int y1, float w1,
+               uint32_t color) {
     int delta_x = (x1 - x0);
     int delta_y = (y1 - y0);
 
@@ -195,6 +246,8 @@ void draw_line(int x0, int y0, float z0, float w0, int x1, int y1, float z1,
 void destroy_window(void) {
     free(color_buffer);
     free(z_buffer);
+    free(ztile_max);
+    free(ztile_writes);
     SDL_DestroyTexture(color_buffer_texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -6,6 +6,10 @@
 #include <stdint.h>
 
 #define FPS 30
+
+// The z-buffer keeps a coarse copy of itself with the farthest depth of every
+// ZTILE_SIZE x ZTILE_SIZE block of pixels
+#define ZTILE_SIZE 8
 #define FRAME_TARGET_TIME (1000 / FPS)
 
 enum cull_method { CULL_NONE, CULL_BACKFACE };
@@ -16,7 +20,8 @@ enum render_method {
     RENDER_FILL_TRIANGLE,
     RENDER_FILL_TRIANGLE_WIRE,
     RENDER_TEXTURED,
-    RENDER_TEXTURED_WIRE
+    RENDER_TEXTURED_WIRE,
+    RENDER_VISIBILITY_BUFFER
 };
 
 int get_window_height();
@@ -27,6 +32,7 @@ void set_cull_method(int method);
 bool is_cull_backface(void);
 bool should_render_filled_triangles(void);
 bool should_render_textured_triangles(void);
+bool should_render_visibility_buffer(void);
 bool should_render_wireframe(void);
 bool should_render_wire_vertex(void);
 
@@ -34,13 +40,17 @@ bool initialize_window(void);
 void draw_grid(uint32_t color, int cell_size);
 void draw_pixel(int x_pos, int y_pos, uint32_t color);
 void draw_rect(int x_pos, int y_pos, int width, int height, uint32_t color);
-void draw_line(int x0, int y0, float z0, float w0, int x1, int y1, float z1,
-               float w1, uint32_t color);
+void draw_line(int x0, int y0, float w0, int x1, int y1, float w1,
+               uint32_t color);
 
 void render_color_buffer();
 
+uint32_t* get_color_buffer(void);
+float* get_z_buffer(void);
 float get_zbuffer_at(int x, int y);
 void update_zbuffer_at(int x, int y, float value);
+float get_ztile_max(int tile_x, int tile_y);
+void add_ztile_writes(int tile_x, int tile_y, int num_pixels);
 
 void clear_color_buffer(uint32_t color);
 void clear_z_buffer(void);
@@ -1,26 +1,146 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "arena.h"
 #include "array.h"
+#include "bvh.h"
 #include "camera.h"
 #include "clipping.h"
 #include "display.h"
 #include "light.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "occlusion.h"
+#include "span.h"
 #include "texture.h"
+#include "threadpool.h"
+#include "tile.h"
+#include "transform.h"
 #include "triangle.h"
 #include "upng.h"
 #include "vector.h"
-
-#define MAX_TRIANGLES_PER_MESH 100000
-triangle_t triangles_to_render[MAX_TRIANGLES_PER_MESH];
+#include "visibility.h"
+
+// Memory for the projected triangles and anything else that only lives
+// until the next frame, released all at once as the frame starts. Frames
+// take turns between two arenas, so one frame's triangles can be drawn
+// while the next frame's are made
+arena_t frame_arenas[2] = {0};
+int frame_arena_index = 0;
+projected_triangle_t* triangles_to_render = NULL;
 int num_triangles_to_render = 0;
+int triangles_to_render_capacity = 1024;  // kept from frame to frame
+
+// Triangles render draws: those of this frame, or in pipelined mode those
+// of the frame before while this frame's geometry runs on the thread pool.
+// Drawing lags the input by one frame at most
+projected_triangle_t* triangles_to_draw = NULL;
+int num_triangles_to_draw = 0;
+bool is_pipelining_enabled = false;
+job_counter_t scene_processed = {0};  // the geometry of the frame ahead
 
 mat4_t world_matrix;
 mat4_t proj_matrix;
 mat4_t view_matrix;
+mat4_t model_view_matrix;  // view * world of the mesh being processed
+mat4_t mvp_matrix;         // proj * view * world of the mesh being processed
+frustum_t mesh_frustum;    // clip planes in the model space of that mesh
+mesh_lod_t* mesh_lod;      // level of detail drawn for that mesh
+
+// Face tests of that mesh in its model space. The cofactors of the
+// model-view matrix take model-space face normals to camera space, and a
+// face plane dotted with backface_test is positive when the face is turned
+// away from the camera
+float normal_matrix[3][3];
+vec4_t backface_test;
+
+// Coarser levels of detail are drawn as long as the surface they leave out
+// stays within this many pixels of the full mesh on screen
+const float LOD_ERROR_PIXELS = 1.0;
+bool is_lod_enabled = true;
+
+// Vertex transforms skipped this frame thanks to faces sharing vertices,
+// compared to transforming three corners per face
+int num_transforms_saved = 0;
+
+// Faces sorted by their clipping outcodes this frame
+int num_faces_inside = 0;   // trivially accepted, never clipped
+int num_faces_outside = 0;  // trivially rejected
+int num_faces_clipped = 0;  // straddling a plane, clipped geometrically
+
+// Meshes sorted by their bounds this frame
+int num_meshes_culled = 0;  // entirely outside, never transformed
+int num_meshes_inside = 0;  // inside the view volume, faces skip the outcodes
+
+// Meshlets dropped this frame before their vertices were transformed
+int num_meshlets_outside = 0;      // outside the view volume
+int num_meshlets_back_facing = 0;  // every face turned away from the camera
+int num_faces_back_facing = 0;     // faces of the back-facing meshlets
+int num_back_faces = 0;            // single faces turned away in the others
+
+// Faces of the full meshes left out this frame by drawing coarser levels
+int num_faces_lod_skipped = 0;
+
+// Meshlets of a chunk left after culling, with the faces of theirs that are
+// not turned away
+typedef struct {
+    int first_face;         // entries in the chunk's visible_faces
+    int num_faces;
+    bool needs_face_tests;  // else it is inside the view volume
+} visible_meshlet_t;
+
+// The meshlets of the level of detail drawn are culled, and their faces
+// clipped and projected, this many at a time on the thread pool. Each chunk
+// fills its own list of triangles and its own counts, joined in chunk order
+// afterwards, so the triangles come out in the same order on any number of
+// threads
+#define GEOMETRY_CHUNK_MESHLETS 16
+
+typedef struct {
+    int first_meshlet;                // of the mesh, within mesh_lod
+    int num_meshlets;
+    int first_block;                  // its meshlets' meshlet_blocks entries
+    int num_blocks;
+    uint8_t* block_marks;             // per entry, read by a face kept
+    visible_meshlet_t* visible_meshlets;
+    int* visible_faces;
+    projected_triangle_t* triangles;  // dynamic array, kept between frames
+    int first_triangle;               // where they go in triangles_to_render
+    int num_faces_inside;
+    int num_faces_outside;
+    int num_faces_clipped;
+    int num_meshlets_outside;
+    int num_meshlets_back_facing;
+    int num_faces_back_facing;
+    int num_back_faces;
+} geometry_chunk_t;
+geometry_chunk_t* geometry_chunks = NULL;  // never shrinks, keeping buffers
+int num_geometry_chunks = 0;               // of the mesh being processed
+
+// Vertex data of the mesh being processed. Meshes go down the pipeline one
+// after the other and only their triangles outlive them, so every mesh and
+// instance shares these, sized for the largest mesh so far
+uint8_t* visible_blocks = NULL;      // blocks read by the faces kept
+vertex_block_t* clip_blocks = NULL;  // clip-space vertices
+uint16_t* vertex_outcodes = NULL;    // clip outcodes of those vertices
+
+// Vertex blocks per transform task
+#define TRANSFORM_TASK_BLOCKS 128
+
+// What the geometry tasks of the mesh being processed share
+typedef struct {
+    mesh_t* mesh;
+    bool mesh_inside;        // inside the view volume, no outcodes needed
+    bool use_cones;          // meshlets are tested with their normal cones
+    vec3_t camera_position;  // model space, for the cones in perspective
+    vec3_t view_direction;   // model space, for the cones in orthographic
+} geometry_pass_t;
+
+// Threads running the jobs of the thread pool, the main thread included
+int num_threads = 1;
 
 bool is_running = false;
 int previous_frame_time = 0;
@@ -46,10 +166,6 @@ void update_projection_matrix(void) {
         float fovy = 3.141592 / 3.0;  // 60 degrees
         float aspecty = (float)get_window_height() / (float)get_window_width();
         proj_matrix = mat4_make_perspective(fovy, aspecty, znear, zfar);
-
-        // Update Frustum Planes for Perspective (Cone)
-        float fovx = atan(tan(fovy / 2) * aspect_ratio) * 2.0;
-        init_frustum_planes(fovx, fovy, znear, zfar);
     } else {
         float top = ortho_height / 2.0;
         float bottom = -top;
@@ -58,41 +174,21 @@ void update_projection_matrix(void) {
 
         proj_matrix =
             mat4_make_orthographic(left, right, bottom, top, znear, zfar);
-
-        // Update Frustum Planes for Ortho
-        // HACK: We use a very wide FOV (170 deg) for the frustum planes
-        // logic to effectively disable side-clipping, since the standard
-        // init_frustum_planes creates a pyramid. We only care about
-        // Near/Far clipping in Ortho here.
-        // float wide_fov = 3.141592 * (170.0 / 180.0);
-        init_frustum_planes_ortho(left, right, top, bottom, znear, zfar);
     }
+    // Clipping happens in clip space, where both projections map the view
+    // volume to the same planes, so there is nothing else to update
 }
 
-// Calculate the furthest point from the center to ensure the object fits
-// regardless of rotation.
+// Radius around the local origin that fits the object regardless of rotation,
+// from the bounding sphere computed at load time
 float get_mesh_radius(mesh_t* mesh) {
-    int num_vertices = array_length(mesh->vertices);
-    if (num_vertices == 0) return 2.0;  // Default fallback
-
-    float max_dist_sq = 0.0;
-
-    // Find vertex furthest from local origin (0,0,0)
-    for (int i = 0; i < num_vertices; i++) {
-        vec3_t v = mesh->vertices[i];
+    if (array_length(mesh->vertices) == 0) return 2.0;  // Default fallback
 
-        // Take mesh scale into account
-        float sx = v.x * mesh->scale.x;
-        float sy = v.y * mesh->scale.y;
-        float sz = v.z * mesh->scale.z;
-
-        float dist_sq = (sx * sx) + (sy * sy) + (sz * sz);
-        if (dist_sq > max_dist_sq) {
-            max_dist_sq = dist_sq;
-        }
-    }
-
-    return sqrt(max_dist_sq);
+    // Take mesh scale into account
+    float scale = fmax(fabs(mesh->scale.x),
+                       fmax(fabs(mesh->scale.y), fabs(mesh->scale.z)));
+    bounds_t bounds = mesh->bounds;
+    return (vec3_length(bounds.center) + bounds.radius) * scale;
 }
 
 void fit_camera_to_mesh(void) {
@@ -125,6 +221,15 @@ void fit_camera_to_mesh(void) {
 }
 
 void setup(void) {
+    // The main thread runs jobs too while it waits for them, so spawn one
+    // worker less than the number of threads
+    init_thread_pool(num_threads - 1);
+    init_tiles(get_window_width(), get_window_height());
+    init_visibility_buffer(get_window_width(), get_window_height());
+    init_span_kernels();
+    init_transform_kernels();
+    init_guard_band(get_window_width(), get_window_height());
+
     set_render_method(RENDER_WIRE);
     set_cull_method(CULL_BACKFACE);
 
@@ -132,15 +237,20 @@ void setup(void) {
     projection_type = PROJ_PERSPECTIVE;
     orbit_radius = 5.0;
 
-    load_mesh("./assets/terrain.obj", "./assets/terrain.png",
-              vec3_new(0.15, 0.15, 0.15), vec3_new(0, -20.0, 0),
-              vec3_new(M_PI / 2, 0, 0));
-    load_mesh("./assets/f22.obj", "./assets/f22.png", vec3_new(1, 1, 1),
-              vec3_new(0, 0, +5), vec3_new(0, 0, 0));
-    load_mesh("./assets/efa.obj", "./assets/efa.png", vec3_new(1, 1, 1),
-              vec3_new(-2, 0, +9), vec3_new(0, 0, 0));
-    load_mesh("./assets/f117.obj", "./assets/f117.png", vec3_new(1, 1, 1),
-              vec3_new(+2, 0, +9), vec3_new(0, 0, 0));
+    // The meshes load, and their textures decode, side by side
+    mesh_file_t scene_files[] = {
+        {"./assets/terrain.obj", "./assets/terrain.png", {0.15, 0.15, 0.15},
+         {0, -20.0, 0}, {M_PI / 2, 0, 0}},
+        {"./assets/f22.obj", "./assets/f22.png", {1, 1, 1}, {0, 0, +5},
+         {0, 0, 0}},
+        {"./assets/efa.obj", "./assets/efa.png", {1, 1, 1}, {-2, 0, +9},
+         {0, 0, 0}},
+        {"./assets/f117.obj", "./assets/f117.png", {1, 1, 1}, {+2, 0, +9},
+         {0, 0, 0}},
+    };
+    int terrain = get_num_meshes();
+    load_meshes(scene_files, 4);
+    get_mesh(terrain)->is_occluder = true;
 
     // load_mesh("./assets/runway.obj", "./assets/runway.png", vec3_new(1, 1,
     // 1),
@@ -195,6 +305,59 @@ void process_input(void) {
                     break;
                 }
 
+                if (event.key.keysym.sym == SDLK_7) {
+                    set_render_method(RENDER_VISIBILITY_BUFFER);
+                    break;
+                }
+
+                if (event.key.keysym.sym == SDLK_k) {
+                    // Cycle through the span kernels this CPU supports
+                    int kernel = get_span_kernel();
+                    do {
+                        kernel = (kernel + 1) % (SPAN_KERNEL_AVX2 + 1);
+                    } while (!set_span_kernel(kernel));
+                    printf("Span kernels: %s\n", get_span_kernel_name());
+                    break;
+                }
+
+                if (event.key.keysym.sym == SDLK_t) {
+                    set_texture_filter((get_texture_filter() + 1) %
+                                       (TEXTURE_FILTER_TRILINEAR + 1));
+                    printf("Texture filter: %s\n", get_texture_filter_name());
+                    break;
+                }
+
+                if (event.key.keysym.sym == SDLK_g) {
+                    set_guard_band(!is_guard_band_enabled());
+                    printf("Guard band clipping: %s\n",
+                           is_guard_band_enabled() ? "on" : "off");
+                    break;
+                }
+
+                if (event.key.keysym.sym == SDLK_h) {
+                    set_occlusion_culling(!is_occlusion_culling_enabled());
+                    printf("Occlusion culling: %s\n",
+                           is_occlusion_culling_enabled() ? "on" : "off");
+                    break;
+                }
+
+                if (event.key.keysym.sym == SDLK_l) {
+                    is_lod_enabled = !is_lod_enabled;
+                    printf("Levels of detail: %s\n",
+                           is_lod_enabled ? "on" : "off");
+                    break;
+                }
+
+                if (event.key.keysym.sym == SDLK_n) {
+                    is_pipelining_enabled = !is_pipelining_enabled;
+                    printf("Pipelined frames: %s%s\n",
+                           is_pipelining_enabled ? "on" : "off",
+                           get_thread_pool_size() > 1
+                               ? ""
+                               : " (no worker threads, drawn unpipelined)");
+                    break;
+                }
+
                 if (event.key.keysym.sym == SDLK_c) {
                     set_cull_method(CULL_BACKFACE);
                     break;
@@ -257,198 +420,647 @@ void process_input(void) {
     }
 }
 
-// GRAPHICS PIPELINE
-// For each mesh, do the following...
-// Model Space          -> original mesh vertices
-// World Space          -> multiply by world matrix
-// Camera Space         -> multiply by view matrix
-// Clipping             -> clip against six frustum planes
-// Projection           -> multiply projection matrix
-// Image Space          -> apply perspective divide
-// Screen Space         -> ready to render
-void process_graphics_pipeline_stages(mesh_t* mesh) {
-    mat4_t scale_matrix =
-        mat4_make_scale(mesh->scale.x, mesh->scale.y, mesh->scale.z);
-    mat4_t translation_matrix = mat4_make_translation(
-        mesh->translation.x, mesh->translation.y, mesh->translation.z);
-    mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh->rotation.x);
-    mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh->rotation.y);
-    mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh->rotation.z);
+// Per-mesh setup: the model-view and clip matrices, the view volume's planes
+// in model space, and what the face tests need to stay in model space too.
+// A face's precomputed plane dotted with backface_test tells whether it is
+// turned away before any of its corners are transformed, and normal_matrix
+// takes the plane's normal to camera space for shading the faces left
+void update_mesh_matrices(mesh_t* mesh) {
+    // Order matters: First scale, rotate, translate [T] * [R] * [S] * v,
+    // then move the world to camera space and on to clip space
+    world_matrix =
+        mat4_make_world(mesh->scale, mesh->rotation, mesh->translation);
+    model_view_matrix = mat4_mul_mat4(view_matrix, world_matrix);
+    mvp_matrix = mat4_mul_mat4(proj_matrix, model_view_matrix);
+    mesh_frustum = make_frustum(&mvp_matrix);
+
+    // With C the cofactor matrix of the model-view matrix's 3x3 part M,
+    // cross(M u, M v) = C cross(u, v), so C takes a model-space face normal
+    // to the direction of the normal of its camera-space corners
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            normal_matrix[i][j] =
+                model_view_matrix.m[(i + 1) % 3][(j + 1) % 3] *
+                    model_view_matrix.m[(i + 2) % 3][(j + 2) % 3] -
+                model_view_matrix.m[(i + 1) % 3][(j + 2) % 3] *
+                    model_view_matrix.m[(i + 2) % 3][(j + 1) % 3];
+        }
+    }
+    // A face is turned away when that normal points the way the camera
+    // looks at the face: along camera-space z in orthographic, along the
+    // corner a in perspective. There, with a = M p + t for p on the face
+    // plane n . p + d = 0, n^T C^T (M p + t) = -det(M) d + n . (C^T t)
+    if (projection_type == PROJ_ORTHOGRAPHIC) {
+        backface_test = (vec4_t){normal_matrix[2][0], normal_matrix[2][1],
+                                 normal_matrix[2][2], 0};
+    } else {
+        float det = 0;
+        float* test = &backface_test.x;
+        for (int j = 0; j < 3; j++) {
+            det += model_view_matrix.m[0][j] * normal_matrix[0][j];
+            test[j] = 0;
+            for (int i = 0; i < 3; i++) {
+                test[j] += normal_matrix[i][j] * model_view_matrix.m[i][3];
+            }
+        }
+        backface_test.w = -det;
+    }
+}
 
-    // loop all triangle faces of our mesh
-    int num_faces = array_length(mesh->faces);
-    for (int i = 0; i < num_faces; i++) {
-        face_t mesh_face = mesh->faces[i];
+/// @brief pick the coarsest level of detail of the mesh whose error stays
+/// under LOD_ERROR_PIXELS on screen, seen from the nearest point of the
+/// mesh's bounding sphere
+mesh_lod_t* select_mesh_lod(mesh_t* mesh) {
+    if (!is_lod_enabled) return &mesh->lods[0];
+
+    // The projection maps a length l at depth z to m[1][1] * l / z of half
+    // the screen height in perspective, to m[1][1] * l in orthographic
+    float scale = fmax(fabs(mesh->scale.x),
+                       fmax(fabs(mesh->scale.y), fabs(mesh->scale.z)));
+    float pixels_per_unit =
+        proj_matrix.m[1][1] * get_window_height() / 2.0 * scale;
+    if (projection_type == PROJ_PERSPECTIVE) {
+        vec4_t center = mat4_mul_vec4(model_view_matrix,
+                                      vec4_from_vec3(mesh->bounds.center));
+        float depth = center.z - mesh->bounds.radius * scale;
+        if (depth <= 0) return &mesh->lods[0];
+        pixels_per_unit /= depth;
+    }
 
-        vec3_t face_vertices[3];
-        face_vertices[0] = mesh->vertices[mesh_face.a];
-        face_vertices[1] = mesh->vertices[mesh_face.b];
-        face_vertices[2] = mesh->vertices[mesh_face.c];
+    int level = 0;
+    while (level + 1 < array_length(mesh->lods) &&
+           mesh->lods[level + 1].error * pixels_per_unit <=
+               LOD_ERROR_PIXELS) {
+        level++;
+    }
+    return &mesh->lods[level];
+}
 
-        vec4_t transformed_vertices[3];
+/// @brief split the meshlets of the mesh's level of detail into chunks and
+/// get the camera ready for their normal cones
+void prepare_geometry_pass(geometry_pass_t* pass, mesh_t* mesh,
+                           bool mesh_inside) {
+    pass->mesh = mesh;
+    pass->mesh_inside = mesh_inside;
+
+    // Normal cones hold as long as the mesh is scaled the same along every
+    // axis. The camera is then brought into model space once, where the
+    // model-view matrix is s * R, so its inverse is R^T / s
+    vec3_t scale = mesh->scale;
+    pass->use_cones = is_cull_backface() && scale.x > 0 &&
+                      scale.x == scale.y && scale.x == scale.z;
+    pass->camera_position = vec3_new(0, 0, 0);
+    pass->view_direction = vec3_new(0, 0, 0);
+    for (int j = 0; j < 3; j++) {
+        float* position = &pass->camera_position.x + j;
+        float* direction = &pass->view_direction.x + j;
+        for (int i = 0; i < 3; i++) {
+            *position -= model_view_matrix.m[i][j] * model_view_matrix.m[i][3];
+            *direction += model_view_matrix.m[i][j] * (i == 2);
+        }
+        *position /= scale.x * scale.x;
+        *direction /= scale.x;
+    }
 
-        // loop all three vertices of this current face and apply
-        // transformations
+    num_geometry_chunks =
+        (mesh_lod->num_meshlets + GEOMETRY_CHUNK_MESHLETS - 1) /
+        GEOMETRY_CHUNK_MESHLETS;
+    int num_new = num_geometry_chunks - array_length(geometry_chunks);
+    if (num_new > 0) {
+        geometry_chunks =
+            array_hold(geometry_chunks, num_new, sizeof(geometry_chunk_t));
+        memset(&geometry_chunks[num_geometry_chunks - num_new], 0,
+               num_new * sizeof(geometry_chunk_t));
+    }
+    for (int i = 0; i < num_geometry_chunks; i++) {
+        geometry_chunk_t* chunk = &geometry_chunks[i];
+        chunk->first_meshlet =
+            mesh_lod->first_meshlet + i * GEOMETRY_CHUNK_MESHLETS;
+        chunk->num_meshlets = mesh_lod->num_meshlets -
+                              i * GEOMETRY_CHUNK_MESHLETS;
+        if (chunk->num_meshlets > GEOMETRY_CHUNK_MESHLETS) {
+            chunk->num_meshlets = GEOMETRY_CHUNK_MESHLETS;
+        }
+        meshlet_t* first_meshlet = &mesh->meshlets[chunk->first_meshlet];
+        meshlet_t* last_meshlet = &first_meshlet[chunk->num_meshlets - 1];
+        chunk->first_block = first_meshlet->first_block;
+        chunk->num_blocks = last_meshlet->first_block +
+                            last_meshlet->num_blocks - chunk->first_block;
+    }
 
-        for (int j = 0; j < 3; j++) {
-            vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
+    int num_blocks = get_num_vertex_blocks(array_length(mesh->vertices));
+    array_clear(visible_blocks);
+    visible_blocks = array_hold(visible_blocks, num_blocks, sizeof(uint8_t));
+    memset(visible_blocks, 0, num_blocks);
+}
+
+// Entry of a vertex block in a meshlet's sorted list of the blocks it reads
+static int find_meshlet_block(const int* blocks, int num_blocks, int block) {
+    int low = 0;
+    int high = num_blocks - 1;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (blocks[middle] < block) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
 
-            // Create a world matrix combining scale, rotation and
-            // translation matrices
-            world_matrix = mat4_identity();
+/// @brief thread pool task keeping the meshlets of a chunk that may be
+/// visible, testing each against the view volume unless the whole mesh is
+/// inside it, and against the camera with its normal cone, then their faces
+/// against the camera with their planes. The vertex blocks the faces left
+/// read are marked in the chunk's own block_marks, since chunks share
+/// blocks; mark_visible_blocks gathers them
+void cull_meshlet_chunk(int chunk_index, void* context) {
+    geometry_pass_t* pass = context;
+    mesh_t* mesh = pass->mesh;
+    geometry_chunk_t* chunk = &geometry_chunks[chunk_index];
+    meshlet_t* first_meshlet = &mesh->meshlets[chunk->first_meshlet];
+    meshlet_t* last_meshlet = &first_meshlet[chunk->num_meshlets - 1];
+    array_clear(chunk->block_marks);
+    chunk->block_marks =
+        array_hold(chunk->block_marks, chunk->num_blocks, sizeof(uint8_t));
+    memset(chunk->block_marks, 0, chunk->num_blocks);
+    array_clear(chunk->visible_meshlets);
+    array_clear(chunk->visible_faces);
+    chunk->visible_faces = array_hold(
+        chunk->visible_faces,
+        last_meshlet->first_face + last_meshlet->num_faces -
+            first_meshlet->first_face,
+        sizeof(int));
+    int num_visible_faces = 0;
+    chunk->num_meshlets_outside = 0;
+    chunk->num_meshlets_back_facing = 0;
+    chunk->num_faces_back_facing = 0;
+    chunk->num_back_faces = 0;
+
+    for (int i = chunk->first_meshlet;
+         i < chunk->first_meshlet + chunk->num_meshlets; i++) {
+        meshlet_t* meshlet = &mesh->meshlets[i];
+        visible_meshlet_t visible = {.first_face = num_visible_faces,
+                                     .needs_face_tests = false};
+        if (!pass->mesh_inside) {
+            int crossed_planes;
+            int outcode = get_bounds_outcode(&mesh_frustum, meshlet->bounds,
+                                             &crossed_planes);
+            if (outcode & OUTCODE_VIEW_PLANES) {
+                chunk->num_meshlets_outside++;
+                continue;
+            }
+            visible.needs_face_tests =
+                (crossed_planes & OUTCODE_VIEW_PLANES) != 0;
+        }
 
-            // Order matters: First scale, rotate, translate [S] * [R] * [T]
-            // * v
-            world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-            world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+        if (pass->use_cones &&
+            is_meshlet_back_facing(meshlet, pass->camera_position,
+                                   pass->view_direction,
+                                   projection_type == PROJ_ORTHOGRAPHIC)) {
+            chunk->num_meshlets_back_facing++;
+            chunk->num_faces_back_facing += meshlet->num_faces;
+            continue;
+        }
 
-            // TODO: multiply the world matrix by the original vector
-            transformed_vertex =
-                mat4_mul_vec4(world_matrix, transformed_vertex);
+        int end_face = meshlet->first_face + meshlet->num_faces;
+        int* blocks = &mesh->meshlet_blocks[meshlet->first_block];
+        uint8_t* marks =
+            &chunk->block_marks[meshlet->first_block - chunk->first_block];
+        if (is_cull_backface()) {
+            // One dot product per face, before any vertex is transformed;
+            // only the corners of the faces left are
+            for (int f = meshlet->first_face; f < end_face; f++) {
+                vec4_t plane = mesh->face_planes[f];
+                float facing = plane.x * backface_test.x +
+                               plane.y * backface_test.y +
+                               plane.z * backface_test.z +
+                               plane.w * backface_test.w;
+                if (facing > 0) {
+                    chunk->num_back_faces++;
+                    continue;
+                }
+                face_t* face = &mesh->faces[f];
+                int corners[3] = {face->a, face->b, face->c};
+                for (int j = 0; j < 3; j++) {
+                    marks[find_meshlet_block(
+                        blocks, meshlet->num_blocks,
+                        corners[j] / VERTEX_BLOCK_SIZE)] = 1;
+                }
+                chunk->visible_faces[num_visible_faces++] = f;
+            }
+        } else {
+            for (int f = meshlet->first_face; f < end_face; f++) {
+                chunk->visible_faces[num_visible_faces++] = f;
+            }
+            memset(marks, 1, meshlet->num_blocks);
+        }
+        visible.num_faces = num_visible_faces - visible.first_face;
+        if (visible.num_faces > 0) {
+            array_push(chunk->visible_meshlets, visible);
+        }
+    }
+}
 
-            // multiply the vector to transform the scene to camera space
-            transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
+/// @brief mark the vertex blocks the chunks' faces read for the transform,
+/// one chunk after the other
+void mark_visible_blocks(mesh_t* mesh) {
+    for (int i = 0; i < num_geometry_chunks; i++) {
+        geometry_chunk_t* chunk = &geometry_chunks[i];
+        int* blocks = &mesh->meshlet_blocks[chunk->first_block];
+        for (int j = 0; j < chunk->num_blocks; j++) {
+            visible_blocks[blocks[j]] |= chunk->block_marks[j];
+        }
+    }
+}
 
-            // Save transformed vertex in the array of transformed vertices
-            transformed_vertices[j] = transformed_vertex;
+/// @brief thread pool task running the marked vertex blocks of one run of
+/// TRANSFORM_TASK_BLOCKS through the matrices of update_mesh_matrices
+void transform_block_range(int task_index, void* context) {
+    geometry_pass_t* pass = context;
+    mesh_t* mesh = pass->mesh;
+    int num_vertices = array_length(mesh->vertices);
+    int num_blocks = get_num_vertex_blocks(num_vertices);
+    int first = task_index * TRANSFORM_TASK_BLOCKS;
+    int end = first + TRANSFORM_TASK_BLOCKS;
+    if (end > num_blocks) end = num_blocks;
+
+    // One kernel call per run of marked blocks, to clip space for clipping
+    // and projection, plus every vertex's outcode so faces can be accepted
+    // or rejected from three lookups. Culling and shading work from the
+    // model-space face planes, so no camera-space copy is needed
+    while (first < end) {
+        if (!visible_blocks[first]) {
+            first++;
+            continue;
+        }
+        int count = 1;
+        while (first + count < end && visible_blocks[first + count]) {
+            count++;
         }
+        transform_vertex_blocks(&mvp_matrix, &mesh->positions[first],
+                                &clip_blocks[first], count);
+
+        if (!pass->mesh_inside) {
+            int first_vertex = first * VERTEX_BLOCK_SIZE;
+            int end_vertex = (first + count) * VERTEX_BLOCK_SIZE;
+            if (end_vertex > num_vertices) end_vertex = num_vertices;
+            for (int i = first_vertex; i < end_vertex; i++) {
+                vertex_outcodes[i] =
+                    get_clip_outcode(get_block_vertex(clip_blocks, i));
+            }
+        }
+        first += count;
+    }
+}
 
-        vec3_t face_normal = get_triangle_normal(transformed_vertices);
+/// @brief run the vertex blocks marked by mark_visible_blocks through the
+/// matrices of update_mesh_matrices on the thread pool. Outcodes are only
+/// needed when some faces may need clipping or rejecting
+void transform_mesh_vertices(mesh_t* mesh, bool with_outcodes) {
+    int num_vertices = array_length(mesh->vertices);
+    int num_blocks = get_num_vertex_blocks(num_vertices);
+    array_clear(clip_blocks);
+    clip_blocks = array_hold(clip_blocks, num_blocks, sizeof(vertex_block_t));
+    array_clear(vertex_outcodes);
+    vertex_outcodes =
+        array_hold(vertex_outcodes, num_vertices, sizeof(uint16_t));
+
+    geometry_pass_t pass = {.mesh = mesh, .mesh_inside = !with_outcodes};
+    parallel_for(
+        (num_blocks + TRANSFORM_TASK_BLOCKS - 1) / TRANSFORM_TASK_BLOCKS, 1,
+        transform_block_range, &pass);
+
+    int num_transformed = 0;
+    for (int i = 0; i < num_blocks; i++) {
+        num_transformed += visible_blocks[i] * VERTEX_BLOCK_SIZE;
+    }
+    if (num_blocks > 0 && visible_blocks[num_blocks - 1]) {
+        num_transformed -= num_blocks * VERTEX_BLOCK_SIZE - num_vertices;
+    }
+    num_transforms_saved += mesh_lod->num_faces * 3 - num_transformed;
+}
 
-        // 3. Find the camera ray vector
-        vec3_t camera_ray;
+/// @brief start a new list of triangles to render in the other arena,
+/// releasing the memory of the frame before the last. The list starts as
+/// large as the last one grew
+void reset_triangles_to_render(void) {
+    frame_arena_index = 1 - frame_arena_index;
+    arena_t* frame_arena = &frame_arenas[frame_arena_index];
+    arena_reset(frame_arena);
+    num_triangles_to_render = 0;
+    triangles_to_render = arena_alloc(
+        frame_arena,
+        triangles_to_render_capacity * sizeof(projected_triangle_t));
+}
 
-        if (projection_type == PROJ_PERSPECTIVE) {
-            // Perspective: Ray from origin (camera) to vertex
-            camera_ray = vec3_sub(vec3_new(0, 0, 0),
-                                  vec3_from_vec4(transformed_vertices[0]));
-        } else {
-            // Orthographic: Parallel rays looking down the Z axis
-            // Since View space conventionally looks down -Z, the vector TO
-            // camera is +Z
-            camera_ray = (vec3_t){0, 0, -1.0};
+/// @brief room for count more triangles to render, returning the first. A
+/// full list moves to twice the room, or more, in the arena, the old one
+/// going away with the next reset
+projected_triangle_t* push_triangles_to_render(int count) {
+    int needed = num_triangles_to_render + count;
+    if (needed > triangles_to_render_capacity) {
+        while (triangles_to_render_capacity < needed) {
+            triangles_to_render_capacity *= 2;
         }
+        projected_triangle_t* grown = arena_alloc(
+            &frame_arenas[frame_arena_index],
+            triangles_to_render_capacity * sizeof(projected_triangle_t));
+        memcpy(grown, triangles_to_render,
+               num_triangles_to_render * sizeof(projected_triangle_t));
+        triangles_to_render = grown;
+    }
+    num_triangles_to_render = needed;
+    return &triangles_to_render[needed - count];
+}
 
-        // 4. Take the dot product between the normal N and the camera ray
-        float dot_normal_camera = vec3_dot(face_normal, camera_ray);
-        // 5. If this dot product is less than zero, then do not display the
-        // face
-        if (is_cull_backface()) {
-            if (dot_normal_camera < 0) {
-                continue;
-            }
+/// @brief clip, shade and project one face that cull_meshlet_chunk kept,
+/// adding what is left of it to the chunk's triangles. Faces of meshlets
+/// inside the view volume skip the outcode tests
+void process_mesh_face(mesh_t* mesh, geometry_chunk_t* chunk, int face_index,
+                       bool needs_face_tests) {
+    face_t mesh_face = mesh->faces[face_index];
+    vec4_t clip_vertices[3] = {
+        get_block_vertex(clip_blocks, mesh_face.a),
+        get_block_vertex(clip_blocks, mesh_face.b),
+        get_block_vertex(clip_blocks, mesh_face.c),
+    };
+
+    // Trivial reject: all three vertices outside the same plane
+    if (needs_face_tests &&
+        (vertex_outcodes[mesh_face.a] & vertex_outcodes[mesh_face.b] &
+         vertex_outcodes[mesh_face.c] & OUTCODE_VIEW_PLANES)) {
+        chunk->num_faces_outside++;
+        return;
+    }
+
+    // The camera-space normal for shading, from the model-space one
+    vec4_t plane = mesh->face_planes[face_index];
+    vec3_t face_normal;
+    float* normal = &face_normal.x;
+    for (int i = 0; i < 3; i++) {
+        normal[i] = normal_matrix[i][0] * plane.x +
+                    normal_matrix[i][1] * plane.y +
+                    normal_matrix[i][2] * plane.z;
+    }
+    vec3_normalize(&face_normal);
+
+    // Trivial accept: without outcode bits that call for clipping the
+    // triangle skips clipping altogether. With the guard band that
+    // includes triangles crossing the screen edges, which the
+    // rasterizer scissors
+    int clip_planes = 0;
+    if (needs_face_tests) {
+        clip_planes = get_clip_planes(vertex_outcodes[mesh_face.a] |
+                                      vertex_outcodes[mesh_face.b] |
+                                      vertex_outcodes[mesh_face.c]);
+    }
+    polygon_t polygon = create_polygon_from_triangle(
+        clip_vertices[0], clip_vertices[1], clip_vertices[2],
+        mesh_face.a_uv, mesh_face.b_uv, mesh_face.c_uv);
+    if (clip_planes == 0) {
+        chunk->num_faces_inside++;
+    } else {
+        // Straddling triangles are clipped, but only against the planes
+        // some of their vertices are outside of
+        chunk->num_faces_clipped++;
+        clip_polygon(&polygon, clip_planes);
+        if (polygon.num_vertices < 3) {
+            return;
         }
+    }
 
-        // TODO: CLIPPING
-        // create a polygon from original transformed triangle to be clipped
-        polygon_t polygon = create_polygon_from_triangle(
-            vec3_from_vec4(transformed_vertices[0]),
-            vec3_from_vec4(transformed_vertices[1]),
-            vec3_from_vec4(transformed_vertices[2]), mesh_face.a_uv,
-            mesh_face.b_uv, mesh_face.c_uv);
+    // Break the polygon into triangles
+    triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLES];
+    int num_triangles_after_clipping = 0;
 
-        // clip the polygon and return a new polygon with potential new
-        // vertices
-        // Clip the polygon
-        clip_polygon(&polygon);
+    triangles_from_polygon(&polygon, triangles_after_clipping,
+                           &num_triangles_after_clipping);
 
-        // --- SAFETY CHECK START ---
-        // If clipping removed all vertices, break the polygon into 0 triangles
-        if (polygon.num_vertices < 3) {
-            continue;  // Skip this face entirely
-        }
-        // --- SAFETY CHECK END ---
-
-        // Break the polygon into triangles
-        triangle_t triangles_after_clipping[MAX_NUM_POLY_TRIANGLES];
-        int num_triangles_after_clipping = 0;
-
-        triangles_from_polygon(&polygon, triangles_after_clipping,
-                               &num_triangles_after_clipping);
-
-        // Loop all the assembled triangles after clipping
-        for (int t = 0; t < num_triangles_after_clipping; t++) {
-            triangle_t triangle_after_clipping = triangles_after_clipping[t];
-            // Loop all three vertices to perform projection
-            vec4_t projected_points[3];
-            for (int j = 0; j < 3; j++) {
-                // project the current vertex
-                projected_points[j] = mat4_mul_vec4_project(
-                    proj_matrix, triangle_after_clipping.points[j]);
-
-                if (projection_type == PROJ_ORTHOGRAPHIC) {
-                    float z_normalized = projected_points[j].z;
-                    projected_points[j].w =
-                        1.0 / ((1.0 - z_normalized) + 0.0001);
-                }
+    // Loop all the assembled triangles after clipping
+    for (int t = 0; t < num_triangles_after_clipping; t++) {
+        triangle_t triangle_after_clipping = triangles_after_clipping[t];
 
-                // scale into viewport
-                projected_points[j].y *= -1;
+        // Occluders fill the occlusion buffer with what they hide
+        if (mesh->is_occluder && is_occlusion_culling_enabled()) {
+            draw_occluder_triangle(triangle_after_clipping.points);
+        }
 
-                projected_points[j].x *= (get_window_width() / 2.0);
-                projected_points[j].y *= (get_window_height() / 2.0);
-                // translate the projected points to the middle of the
-                // screen
-                projected_points[j].x += (get_window_width() / 2.0);
-                projected_points[j].y += (get_window_height() / 2.0);
+        // Loop all three vertices to perform projection
+        vec4_t projected_points[3];
+        for (int j = 0; j < 3; j++) {
+            // perspective divide of the clip-space vertex, w stays for
+            // perspective-correct interpolation
+            vec4_t point = triangle_after_clipping.points[j];
+            projected_points[j] =
+                (vec4_t){point.x / point.w, point.y / point.w,
+                         point.z / point.w, point.w};
+
+            if (projection_type == PROJ_ORTHOGRAPHIC) {
+                float z_normalized = projected_points[j].z;
+                projected_points[j].w =
+                    1.0 / ((1.0 - z_normalized) + 0.0001);
             }
 
-            // Fix 6: Discard garbage triangles
-            if (projected_points[0].x < -10000 ||
-                projected_points[0].x > 10000 ||
-                projected_points[0].y < -10000 ||
-                projected_points[0].y > 10000) {
-                continue;
-            }
+            // scale into viewport
+            projected_points[j].y *= -1;
+
+            projected_points[j].x *= (get_window_width() / 2.0);
+            projected_points[j].y *= (get_window_height() / 2.0);
+            // translate the projected points to the middle of the
+            // screen
+            projected_points[j].x += (get_window_width() / 2.0);
+            projected_points[j].y += (get_window_height() / 2.0);
+        }
+
+        // calculate the shade intensity based on how aligned ois the
+        // face normal and the light
+        float light_intensity_factor =
+            -1 *
+            vec3_dot(face_normal,
+                     light.direction);  // fixing the light intensity
+                                        // factor to point inwards with -1
+
+        // calculate the triangle color based on light angle, tinted for the
+        // instance
+        uint32_t triangle_color = light_apply_intensity(
+            modulate_color(mesh_face.color, mesh->tint),
+            light_intensity_factor);
+
+        // save projected triangle to the chunk's list of triangles
+        chunk->triangles = array_hold(chunk->triangles, 1,
+                                      sizeof(projected_triangle_t));
+        projected_triangle_t* projected_triangle =
+            &chunk->triangles[array_length(chunk->triangles) - 1];
+        for (int j = 0; j < 3; j++) {
+            projected_triangle->points[j] =
+                (screen_point_t){projected_points[j].x, projected_points[j].y,
+                                 projected_points[j].w};
+            projected_triangle->texcoords[j] =
+                triangle_after_clipping.texcoords[j];
+        }
+        projected_triangle->color = triangle_color;
+        projected_triangle->texture = mesh->texture;
+    }
+}
+
+/// @brief thread pool task clipping, shading and projecting the faces a
+/// chunk kept into its own list of triangles
+void process_chunk_faces(int chunk_index, void* context) {
+    geometry_pass_t* pass = context;
+    geometry_chunk_t* chunk = &geometry_chunks[chunk_index];
+    array_clear(chunk->triangles);
+    chunk->num_faces_inside = 0;
+    chunk->num_faces_outside = 0;
+    chunk->num_faces_clipped = 0;
+    for (int m = 0; m < array_length(chunk->visible_meshlets); m++) {
+        visible_meshlet_t* visible = &chunk->visible_meshlets[m];
+        for (int i = visible->first_face;
+             i < visible->first_face + visible->num_faces; i++) {
+            process_mesh_face(pass->mesh, chunk, chunk->visible_faces[i],
+                              visible->needs_face_tests);
+        }
+    }
+}
+
+/// @brief thread pool task copying a chunk's triangles to its place in the
+/// triangles to render
+void copy_chunk_triangles(int chunk_index, void* context) {
+    (void)context;
+    geometry_chunk_t* chunk = &geometry_chunks[chunk_index];
+    memcpy(&triangles_to_render[chunk->first_triangle], chunk->triangles,
+           array_length(chunk->triangles) * sizeof(projected_triangle_t));
+}
+
+/// @brief add the chunks' triangles to the triangles to render in chunk
+/// order, and their counts to the frame's
+void merge_geometry_chunks(void) {
+    int first_triangle = num_triangles_to_render;
+    int num_triangles = 0;
+    for (int i = 0; i < num_geometry_chunks; i++) {
+        geometry_chunk_t* chunk = &geometry_chunks[i];
+        chunk->first_triangle = first_triangle + num_triangles;
+        num_triangles += array_length(chunk->triangles);
+        num_faces_inside += chunk->num_faces_inside;
+        num_faces_outside += chunk->num_faces_outside;
+        num_faces_clipped += chunk->num_faces_clipped;
+        num_meshlets_outside += chunk->num_meshlets_outside;
+        num_meshlets_back_facing += chunk->num_meshlets_back_facing;
+        num_faces_back_facing += chunk->num_faces_back_facing;
+        num_back_faces += chunk->num_back_faces;
+    }
+    push_triangles_to_render(num_triangles);
+    parallel_for(num_geometry_chunks, 1, copy_chunk_triangles, NULL);
+}
+
+void free_geometry_chunks(void) {
+    for (int i = 0; i < array_length(geometry_chunks); i++) {
+        array_free(geometry_chunks[i].block_marks);
+        array_free(geometry_chunks[i].visible_meshlets);
+        array_free(geometry_chunks[i].visible_faces);
+        array_free(geometry_chunks[i].triangles);
+    }
+    array_free(geometry_chunks);
+    geometry_chunks = NULL;
+    num_geometry_chunks = 0;
+    array_free(visible_blocks);
+    array_free(clip_blocks);
+    array_free(vertex_outcodes);
+    visible_blocks = NULL;
+    clip_blocks = NULL;
+    vertex_outcodes = NULL;
+}
+
+// GRAPHICS PIPELINE
+// For each mesh, do the following...
+// Model Space          -> original mesh vertices
+// World Space          -> multiply by world matrix
+// Camera Space         -> multiply by view matrix, combined with the world
+//                         matrix once per mesh
+// Clip Space           -> multiply by projection matrix, also once per mesh
+// Clipping             -> accept or reject by outcodes, clip the rest
+// Image Space          -> apply perspective divide
+// Screen Space         -> ready to render
+void process_graphics_pipeline_stages(mesh_t* mesh) {
+    update_mesh_matrices(mesh);
+
+    // Whole-mesh culling: a mesh whose bounds are outside a view plane is
+    // skipped before any of its vertices are transformed, and one whose
+    // bounds are inside the view volume lets its faces skip the outcode tests
+    int crossed_planes;
+    int outcode = get_bounds_outcode(&mesh_frustum, mesh->bounds,
+                                     &crossed_planes);
+    if (outcode & OUTCODE_VIEW_PLANES) {
+        num_meshes_culled++;
+        return;
+    }
+    // Meshes hidden behind the occluders drawn so far are skipped as well
+    if (is_occlusion_culling_enabled() && !mesh->is_occluder &&
+        is_bounds_occluded(&mvp_matrix, mesh->bounds)) {
+        return;
+    }
+    bool mesh_inside = (crossed_planes & OUTCODE_VIEW_PLANES) == 0;
+    if (mesh_inside) {
+        num_meshes_inside++;
+    }
 
-            // calculate the shade intensity based on how aligned ois the
-            // face normal and the light
-            float light_intensity_factor =
-                -1 *
-                vec3_dot(face_normal,
-                         light.direction);  // fixing the light intensity
-                                            // factor to point inwards with -1
-
-            // calculate the triangle color based on light angle
-            uint32_t triangle_color =
-                light_apply_intensity(mesh_face.color, light_intensity_factor);
-
-            triangle_t projected_triangle = {
-                .points =
-                    {
-                        {projected_points[0].x, projected_points[0].y,
-                         projected_points[0].z, projected_points[0].w},
-                        {projected_points[1].x, projected_points[1].y,
-                         projected_points[1].z, projected_points[1].w},
-                        {projected_points[2].x, projected_points[2].y,
-                         projected_points[2].z, projected_points[2].w},
-
-                    },
-                .texcoords =
-                    {
-                        {triangle_after_clipping.texcoords[0].u,
-                         triangle_after_clipping.texcoords[0].v},
-                        {triangle_after_clipping.texcoords[1].u,
-                         triangle_after_clipping.texcoords[1].v},
-                        {triangle_after_clipping.texcoords[2].u,
-                         triangle_after_clipping.texcoords[2].v},
-                    },
-                .color = triangle_color,
-                .texture = mesh->texture};
-
-            // save projected triangle to the array of triangles to render
-            if (num_triangles_to_render < MAX_TRIANGLES_PER_MESH) {
-                triangles_to_render[num_triangles_to_render] =
-                    projected_triangle;
-                num_triangles_to_render++;
+    // Distant meshes draw a coarser level of detail
+    mesh_lod = select_mesh_lod(mesh);
+    num_faces_lod_skipped += mesh->lods[0].num_faces - mesh_lod->num_faces;
+
+    // Meshlets outside the view volume or facing away are dropped with one
+    // test each, before any of their vertices are transformed. Culling,
+    // transforming and the faces each spread over the thread pool, waiting
+    // for the stage before
+    geometry_pass_t pass;
+    prepare_geometry_pass(&pass, mesh, mesh_inside);
+    parallel_for(num_geometry_chunks, 1, cull_meshlet_chunk, &pass);
+    mark_visible_blocks(mesh);
+    transform_mesh_vertices(mesh, !mesh_inside);
+
+    // Occluders draw into the one occlusion buffer as their faces are
+    // clipped, so their chunks go one at a time
+    if (mesh->is_occluder && is_occlusion_culling_enabled()) {
+        for (int i = 0; i < num_geometry_chunks; i++) {
+            process_chunk_faces(i, &pass);
+        }
+    } else {
+        parallel_for(num_geometry_chunks, 1, process_chunk_faces, &pass);
+    }
+    merge_geometry_chunks();
+}
+
+/// @brief run the meshes in view through the pipeline, occluders first so
+/// the others can be tested against what they hide. Every mesh and instance
+/// goes through on its own, with its own matrices; instances of a mesh come
+/// one after the other, while the vertex blocks, meshlets and faces they
+/// share are still in the cache
+void process_scene(void) {
+    clear_occlusion_buffer();
+
+    // Only the meshes the scene's bounding volume hierarchy finds in the view
+    // volume go down the pipeline
+    update_scene_bvh();
+    mat4_t view_proj_matrix = mat4_mul_mat4(proj_matrix, view_matrix);
+    int* visible_meshes = get_visible_meshes(&view_proj_matrix);
+    for (int pass = 0; pass < 2; pass++) {
+        bool occluders = pass == 0;
+        for (int i = 0; i < array_length(visible_meshes); i++) {
+            mesh_t* mesh = get_mesh(visible_meshes[i]);
+            if (mesh->is_occluder == occluders) {
+                process_graphics_pipeline_stages(mesh);
             }
         }
     }
 }
 
+void process_scene_job(int task_index, void* context) {
+    (void)task_index;
+    (void)context;
+    process_scene();
+}
+
 void update(void) {
     // Wait some time until the reach the target frame time in milliseconds
     int time_to_wait =
@@ -459,7 +1071,21 @@ void update(void) {
     delta_time = (SDL_GetTicks() - previous_frame_time) / 1000.0;
     previous_frame_time = SDL_GetTicks();
 
-    num_triangles_to_render = 0;
+    // The last frame's triangles are drawn in pipelined mode
+    triangles_to_draw = triangles_to_render;
+    num_triangles_to_draw = num_triangles_to_render;
+    reset_triangles_to_render();
+    num_transforms_saved = 0;
+    num_faces_inside = 0;
+    num_faces_outside = 0;
+    num_faces_clipped = 0;
+    num_meshes_culled = 0;
+    num_meshes_inside = 0;
+    num_meshlets_outside = 0;
+    num_meshlets_back_facing = 0;
+    num_faces_back_facing = 0;
+    num_back_faces = 0;
+    num_faces_lod_skipped = 0;
 
     if (projection_type == PROJ_ORTHOGRAPHIC) {
         orbit_radius = ORTHO_CAMERA_DISTANCE;
@@ -474,13 +1100,22 @@ void update(void) {
 
     view_matrix = mat4_look_at(camera.position, target, up_direction);
 
-    // loop all the meshes in our scene
-    for (int mesh_index = 0; mesh_index < get_num_meshes(); mesh_index++) {
-        mesh_t* mesh = get_mesh(mesh_index);
-
-        mesh_t* fighter = get_mesh(1);
-        fighter->rotation.y = sin((SDL_GetTicks() / 1000.0f) * 2.0f) * 1.0f;
-        process_graphics_pipeline_stages(mesh);
+    mesh_t* fighter = get_mesh(1);
+    vec3_t fighter_rotation = fighter->rotation;
+    fighter_rotation.y = sin((SDL_GetTicks() / 1000.0f) * 2.0f) * 1.0f;
+    set_mesh_transform(1, fighter->scale, fighter->translation,
+                       fighter_rotation);
+
+    // In pipelined mode the scene goes down the pipeline on the thread pool
+    // while render draws the frame before; render waits for it as it ends.
+    // A pool without workers would run the job right here, so nothing would
+    // overlap and the frame would only be drawn late
+    if (is_pipelining_enabled && get_thread_pool_size() > 1) {
+        add_background_job(process_scene_job, 0, NULL, &scene_processed);
+    } else {
+        process_scene();
+        triangles_to_draw = triangles_to_render;
+        num_triangles_to_draw = num_triangles_to_render;
     }
 }
 
@@ -490,43 +1125,25 @@ void render(void) {
 
     draw_grid(0xFF333333, 10);
 
-    // Loop all projected triangles and render them
-    for (int i = 0; i < num_triangles_to_render; i++) {
-        triangle_t triangle = triangles_to_render[i];
-
-        if (should_render_filled_triangles()) {
-            draw_filled_triangle(triangle.points[0].x, triangle.points[0].y,
-                                 triangle.points[0].z, triangle.points[0].w,
-                                 triangle.points[1].x, triangle.points[1].y,
-                                 triangle.points[1].z, triangle.points[1].w,
-                                 triangle.points[2].x, triangle.points[2].y,
-                                 triangle.points[2].z, triangle.points[2].w,
-                                 triangle.color);
-        }
-
-        // Draw textured triangle
-        if (should_render_textured_triangles()) {
-            draw_textured_triangle(
-                triangle.points[0].x, triangle.points[0].y,
-                triangle.points[0].z, triangle.points[0].w,
-                triangle.texcoords[0].u, triangle.texcoords[0].v,
-                triangle.points[1].x, triangle.points[1].y,
-                triangle.points[1].z, triangle.points[1].w,
-                triangle.texcoords[1].u, triangle.texcoords[1].v,
-                triangle.points[2].x, triangle.points[2].y,
-                triangle.points[2].z, triangle.points[2].w,
-                triangle.texcoords[2].u, triangle.texcoords[2].v,
-                triangle.texture, triangle.color);
-        }
+    // Fill and texture the projected triangles tile by tile on the thread
+    // pool; each tile only touches its own part of the color and z buffers
+    if (should_render_filled_triangles() ||
+        should_render_textured_triangles() ||
+        should_render_visibility_buffer()) {
+        bin_triangles_to_tiles(triangles_to_draw, num_triangles_to_draw);
+        render_tiles(triangles_to_draw);
+    }
+
+    // Loop all projected triangles and render the wireframe overlays
+    for (int i = 0; i < num_triangles_to_draw; i++) {
+        projected_triangle_t triangle = triangles_to_draw[i];
 
         if (should_render_wireframe()) {
             draw_triangle(triangle.points[0].x, triangle.points[0].y,
-                          triangle.points[0].z, triangle.points[0].w,
-                          triangle.points[1].x, triangle.points[1].y,
-                          triangle.points[1].z, triangle.points[1].w,
+                          triangle.points[0].w, triangle.points[1].x,
+                          triangle.points[1].y, triangle.points[1].w,
                           triangle.points[2].x, triangle.points[2].y,
-                          triangle.points[2].z, triangle.points[2].w,
-                          0xFFFFFFFF);
+                          triangle.points[2].w, 0xFFFFFFFF);
         }
 
         if (should_render_wire_vertex()) {
@@ -540,16 +1157,392 @@ void render(void) {
     }
 
     render_color_buffer();
+
+    // The frame ahead has to be done before the next input changes what its
+    // geometry reads
+    wait_for_jobs(&scene_processed);
+}
+
+/// @brief time the geometry stages alone, from model space to projected
+/// triangles, on a mesh heavy enough for the per-vertex cost to dominate.
+/// Nothing is rasterized, so no window is needed
+void benchmark_geometry(int num_frames, char* obj_filename) {
+    init_transform_kernels();
+    init_guard_band(get_window_width(), get_window_height());
+    set_cull_method(CULL_BACKFACE);
+    update_projection_matrix();
+    view_matrix = mat4_look_at(vec3_new(0, 0, 0), vec3_new(0, 0, 5),
+                               vec3_new(0, 1, 0));
+
+    load_mesh(obj_filename, NULL, vec3_new(1, 1, 1),
+              vec3_new(0, 0, 5), vec3_new(0, 0, 0));
+    int mesh_index = get_num_meshes() - 1;
+    mesh_t* mesh = get_mesh(mesh_index);
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    int num_triangles = 0;
+    num_faces_inside = 0;
+    num_faces_outside = 0;
+    num_faces_clipped = 0;
+    num_meshes_culled = 0;
+    num_meshes_inside = 0;
+    num_meshlets_outside = 0;
+    num_meshlets_back_facing = 0;
+    num_faces_back_facing = 0;
+    num_back_faces = 0;
+    num_faces_lod_skipped = 0;
+    for (int frame = 0; frame < num_frames; frame++) {
+        // Spin the mesh so culling and clipping see varying work
+        set_mesh_transform(mesh_index, mesh->scale, mesh->translation,
+                           vec3_new(0, frame * 0.01, 0));
+        reset_triangles_to_render();
+        num_transforms_saved = 0;
+        process_graphics_pipeline_stages(mesh);
+        num_triangles += num_triangles_to_render;
+    }
+    double elapsed_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                        SDL_GetPerformanceFrequency();
+
+    printf("Geometry benchmark: %s, %d vertices, %d faces, %d frames\n",
+           obj_filename, array_length(mesh->vertices),
+           mesh->lods[0].num_faces, num_frames);
+    for (int i = 1; i < array_length(mesh->lods); i++) {
+        printf("  level of detail %d: %d faces, %d meshlets, error %g\n", i,
+               mesh->lods[i].num_faces, mesh->lods[i].num_meshlets,
+               mesh->lods[i].error);
+    }
+    printf("  %.3f ms per frame, %d triangles per frame, %s transform\n",
+           elapsed_ms / num_frames, num_triangles / num_frames,
+           get_transform_kernel_name());
+    printf("  %d vertex transforms saved per frame\n", num_transforms_saved);
+    arena_t* frame_arena = &frame_arenas[frame_arena_index];
+    printf("  %zu KB of frame arena used by the last frame, %zu KB held\n",
+           frame_arena->used / 1024, arena_get_size(frame_arena) / 1024);
+    printf("  %d faces inside, %d outside and %d clipped per frame\n",
+           num_faces_inside / num_frames, num_faces_outside / num_frames,
+           num_faces_clipped / num_frames);
+    printf("  mesh culled in %d frames, inside the view volume in %d\n",
+           num_meshes_culled, num_meshes_inside);
+    printf("  %d of %d meshlets outside and %d back-facing per frame, "
+           "skipping %d faces\n",
+           num_meshlets_outside / num_frames, mesh_lod->num_meshlets,
+           num_meshlets_back_facing / num_frames,
+           num_faces_back_facing / num_frames);
+    printf("  %d more faces per frame back-facing before the transform\n",
+           num_back_faces / num_frames);
+    printf("  %d faces per frame left out by the levels of detail\n",
+           num_faces_lod_skipped / num_frames);
+
+    // The same frames again with the chunks spread over the threads
+    init_thread_pool(num_threads - 1);
+    start = SDL_GetPerformanceCounter();
+    for (int frame = 0; frame < num_frames; frame++) {
+        set_mesh_transform(mesh_index, mesh->scale, mesh->translation,
+                           vec3_new(0, frame * 0.01, 0));
+        reset_triangles_to_render();
+        process_graphics_pipeline_stages(mesh);
+    }
+    elapsed_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                 SDL_GetPerformanceFrequency();
+    printf("  %.3f ms per frame on %d threads\n", elapsed_ms / num_frames,
+           get_thread_pool_size());
+    free_thread_pool();
+
+    // Further and further away, with and without levels of detail
+    for (float distance = 10; distance <= 160; distance *= 2) {
+        set_mesh_transform(mesh_index, mesh->scale,
+                           vec3_new(0, 0, distance), mesh->rotation);
+        for (int lod = 1; lod >= 0; lod--) {
+            is_lod_enabled = lod;
+            num_triangles = 0;
+            start = SDL_GetPerformanceCounter();
+            for (int frame = 0; frame < num_frames; frame++) {
+                set_mesh_transform(mesh_index, mesh->scale,
+                                   mesh->translation,
+                                   vec3_new(0, frame * 0.01, 0));
+                reset_triangles_to_render();
+                process_graphics_pipeline_stages(mesh);
+                num_triangles += num_triangles_to_render;
+            }
+            elapsed_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                         SDL_GetPerformanceFrequency();
+            printf("  %.3f ms per frame, %d triangles at distance %g, "
+                   "levels of detail %s\n",
+                   elapsed_ms / num_frames, num_triangles / num_frames,
+                   distance, lod ? "on" : "off");
+        }
+    }
+    is_lod_enabled = true;
+    set_mesh_transform(mesh_index, mesh->scale, vec3_new(0, 0, 5),
+                       mesh->rotation);
+
+    // The transform stage on its own, for every vertex, with every kernel
+    // the CPU can run
+    memset(visible_blocks, 1, array_length(visible_blocks));
+    int selected_kernel = get_transform_kernel();
+    for (int kernel = TRANSFORM_KERNEL_SCALAR; kernel <= TRANSFORM_KERNEL_AVX2;
+         kernel++) {
+        if (!set_transform_kernel(kernel)) continue;
+        start = SDL_GetPerformanceCounter();
+        for (int frame = 0; frame < num_frames; frame++) {
+            transform_mesh_vertices(mesh, true);
+        }
+        elapsed_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                     SDL_GetPerformanceFrequency();
+        printf("  %.4f ms per frame in the %s transform stage\n",
+               elapsed_ms / num_frames, get_transform_kernel_name());
+    }
+    set_transform_kernel(selected_kernel);
+
+    free_meshes();
+}
+
+/// @brief time culling a scene of many small meshes spread over a plane
+/// around the camera, with the bounding volume hierarchy and with a test per
+/// mesh, and time ray queries into it
+void benchmark_scene(int num_meshes, char* obj_filename) {
+    update_projection_matrix();
+    view_matrix = mat4_look_at(vec3_new(0, 2, 0), vec3_new(0, 2, 5),
+                               vec3_new(0, 1, 0));
+    mat4_t view_proj_matrix = mat4_mul_mat4(proj_matrix, view_matrix);
+
+    int side = ceil(sqrt(num_meshes));
+    for (int i = 0; i < num_meshes; i++) {
+        vec3_t translation = {(i % side - side / 2) * 4.0, 0,
+                              (i / side - side / 2) * 4.0};
+        load_mesh(obj_filename, NULL, vec3_new(1, 1, 1), translation,
+                  vec3_new(0, 0, 0));
+    }
+    // A wall across the view hides the meshes beyond it
+    load_mesh(obj_filename, NULL, vec3_new(40, 4, 0.5), vec3_new(0, 2, 12),
+              vec3_new(0, 0, 0));
+    get_mesh(get_num_meshes() - 1)->is_occluder = true;
+    Uint64 start = SDL_GetPerformanceCounter();
+    update_scene_bvh();
+    double build_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                      SDL_GetPerformanceFrequency();
+
+    const int num_frames = 100;
+    int num_visible = 0;
+    int num_visited = 0;
+    start = SDL_GetPerformanceCounter();
+    for (int frame = 0; frame < num_frames; frame++) {
+        num_visible = array_length(get_visible_meshes(&view_proj_matrix));
+        num_visited = get_num_bvh_nodes_visited();
+    }
+    double bvh_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                    SDL_GetPerformanceFrequency() / num_frames;
+
+    int num_linear_visible = 0;
+    start = SDL_GetPerformanceCounter();
+    for (int frame = 0; frame < num_frames; frame++) {
+        num_linear_visible = 0;
+        for (int i = 0; i < num_meshes; i++) {
+            update_mesh_matrices(get_mesh(i));
+            int crossed_planes;
+            int outcode = get_bounds_outcode(
+                &mesh_frustum, get_mesh(i)->bounds, &crossed_planes);
+            if ((outcode & OUTCODE_VIEW_PLANES) == 0) num_linear_visible++;
+        }
+    }
+    double linear_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                       SDL_GetPerformanceFrequency() / num_frames;
+
+    // Every mesh turning a little each frame
+    start = SDL_GetPerformanceCounter();
+    for (int frame = 0; frame < num_frames; frame++) {
+        for (int i = 0; i < num_meshes; i++) {
+            mesh_t* mesh = get_mesh(i);
+            set_mesh_transform(i, mesh->scale, mesh->translation,
+                               vec3_new(0, frame * 0.01, 0));
+        }
+        update_scene_bvh();
+    }
+    double refit_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                      SDL_GetPerformanceFrequency() / num_frames;
+
+    // Rays fanning out from the camera over the plane
+    const int num_rays = 1000;
+    int num_hits = 0;
+    int num_ray_visited = 0;
+    start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < num_rays; i++) {
+        float angle = (i / (float)num_rays - 0.5) * M_PI;
+        vec3_t direction = {sin(angle), -0.05, cos(angle)};
+        float distance;
+        if (raycast_scene(vec3_new(0, 2, 0), direction, &distance) >= 0) {
+            num_hits++;
+        }
+        num_ray_visited += get_num_bvh_nodes_visited();
+    }
+    double ray_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                    SDL_GetPerformanceFrequency() / num_rays;
+
+    // The whole geometry stage, with and without occlusion culling
+    double pipeline_ms[2];
+    int num_occluded = 0;
+    int num_triangles[2];
+    for (int occlusion = 0; occlusion < 2; occlusion++) {
+        set_occlusion_culling(occlusion);
+        start = SDL_GetPerformanceCounter();
+        for (int frame = 0; frame < num_frames; frame++) {
+            reset_triangles_to_render();
+            process_scene();
+        }
+        pipeline_ms[occlusion] = (SDL_GetPerformanceCounter() - start) *
+                                 1000.0 / SDL_GetPerformanceFrequency() /
+                                 num_frames;
+        num_triangles[occlusion] = num_triangles_to_render;
+        num_occluded = get_num_occlusion_culled();
+    }
+
+    printf("Scene benchmark: %s, %d meshes behind a wall\n", obj_filename,
+           num_meshes);
+    printf("  %.3f ms to build the tree, %.3f ms to refit it\n", build_ms,
+           refit_ms);
+    printf("  %.4f ms to cull with the tree, %d visible, %d nodes visited\n",
+           bvh_ms, num_visible, num_visited);
+    printf("  %.4f ms to cull mesh by mesh, %d visible\n", linear_ms,
+           num_linear_visible);
+    printf("  %.4f ms per ray, %d of %d rays hit, %d nodes per ray\n",
+           ray_ms, num_hits, num_rays, num_ray_visited / num_rays);
+    printf("  %.4f ms through the pipeline, %d triangles\n", pipeline_ms[0],
+           num_triangles[0]);
+    printf("  %.4f ms with occlusion culling, %d triangles, %d of %d meshes "
+           "occluded\n",
+           pipeline_ms[1], num_triangles[1], num_occluded,
+           num_occluded + get_num_occlusion_visible());
+
+    free_scene_bvh();
+    free_meshes();
+}
+
+// Bytes the meshes hold: every mesh's struct, the geometry and texture
+// instances share counted once, and the vertex buffers all meshes share
+int get_mesh_memory(void) {
+    int bytes = array_length(visible_blocks) * sizeof(uint8_t) +
+                array_length(clip_blocks) * sizeof(vertex_block_t) +
+                array_length(vertex_outcodes) * sizeof(uint16_t);
+    for (int i = 0; i < get_num_meshes(); i++) {
+        mesh_t* mesh = get_mesh(i);
+        bytes += sizeof(mesh_t);
+        if (mesh->asset != i) continue;
+        bytes += array_length(mesh->vertices) * sizeof(vec3_t) +
+                 array_length(mesh->faces) * sizeof(face_t) +
+                 array_length(mesh->face_planes) * sizeof(vec4_t) +
+                 array_length(mesh->lods) * sizeof(mesh_lod_t) +
+                 array_length(mesh->meshlets) * sizeof(meshlet_t) +
+                 array_length(mesh->meshlet_blocks) * sizeof(int) +
+                 array_length(mesh->positions) * sizeof(position_block_t);
+        for (int j = 0; mesh->texture && j < mesh->texture->num_levels;
+             j++) {
+            mip_level_t* level = &mesh->texture->levels[j];
+            bytes += level->width * level->height * sizeof(uint32_t);
+        }
+    }
+    return bytes;
+}
+
+/// @brief time loading a squadron of one model and running it through the
+/// geometry stages, once as separately loaded meshes and once as instances
+/// of a single mesh
+void benchmark_instances(int num_instances, char* obj_filename,
+                         char* png_filename) {
+    update_projection_matrix();
+    view_matrix = mat4_look_at(vec3_new(0, 10, -20), vec3_new(0, 0, 20),
+                               vec3_new(0, 1, 0));
+    const int num_frames = 100;
+
+    printf("Instancing benchmark: %d x %s\n", num_instances, obj_filename);
+    for (int instanced = 0; instanced < 2; instanced++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        int side = ceil(sqrt(num_instances));
+        for (int i = 0; i < num_instances; i++) {
+            vec3_t translation = {(i % side - side / 2) * 3.0, 0,
+                                  (i / side) * 3.0};
+            if (instanced && i > 0) {
+                // Every other plane a little darker
+                uint32_t tint = i % 2 ? 0xFFFFFFFF : 0xFFC0C0C0;
+                add_mesh_instance(0, vec3_new(1, 1, 1), translation,
+                                  vec3_new(0, 0, 0), tint);
+            } else {
+                load_mesh(obj_filename, png_filename, vec3_new(1, 1, 1),
+                          translation, vec3_new(0, 0, 0));
+            }
+        }
+        double load_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                         SDL_GetPerformanceFrequency();
+
+        start = SDL_GetPerformanceCounter();
+        for (int frame = 0; frame < num_frames; frame++) {
+            reset_triangles_to_render();
+            process_scene();
+        }
+        double pipeline_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                             SDL_GetPerformanceFrequency() / num_frames;
+
+        printf("  %s: %.3f ms to load, %d KB of meshes, geometry and "
+               "texture\n",
+               instanced ? "instances" : "separate meshes", load_ms,
+               get_mesh_memory() / 1024);
+        printf("    %.4f ms through the pipeline, %d triangles\n",
+               pipeline_ms, num_triangles_to_render);
+
+        free_scene_bvh();
+        free_meshes();
+    }
 }
 
 /// @brief free memory that was dynamically allocated by the program
 /// @param  none
 void free_resources(void) {
+    arena_free(&frame_arenas[0]);
+    arena_free(&frame_arenas[1]);
+    free_geometry_chunks();
     free_meshes();
+    free_scene_bvh();
+    free_tiles();
+    free_visibility_buffer();
+    free_thread_pool();
     destroy_window();
 }
 
-int main(void) {
+int main(int argc, char* argv[]) {
+    // --threads <count> before any other option sets how many threads run
+    // jobs, the main thread included; 1 runs everything on the main thread,
+    // in order, for debugging
+    num_threads = SDL_GetCPUCount();
+    if (argc > 2 && strcmp(argv[1], "--threads") == 0) {
+        num_threads = atoi(argv[2]);
+        if (num_threads < 1) num_threads = 1;
+        argc -= 2;
+        argv += 2;
+    }
+
+    // --bench-geometry [frames] [obj file] times the geometry stages and
+    // exits
+    if (argc > 1 && strcmp(argv[1], "--bench-geometry") == 0) {
+        benchmark_geometry(argc > 2 ? atoi(argv[2]) : 1000,
+                           argc > 3 ? argv[3] : "./assets/dragon.obj");
+        return 0;
+    }
+    // --bench-scene [meshes] [obj file] times culling and ray queries over
+    // many meshes and exits
+    if (argc > 1 && strcmp(argv[1], "--bench-scene") == 0) {
+        benchmark_scene(argc > 2 ? atoi(argv[2]) : 4096,
+                        argc > 3 ? argv[3] : "./assets/cube.obj");
+        return 0;
+    }
+
+    // --bench-instances [count] [obj file] [png file] compares separately
+    // loaded meshes with instances of one mesh and exits
+    if (argc > 1 && strcmp(argv[1], "--bench-instances") == 0) {
+        benchmark_instances(argc > 2 ? atoi(argv[2]) : 500,
+                            argc > 3 ? argv[3] : "./assets/f22.obj",
+                            argc > 4 ? argv[4] : "./assets/f22.png");
+        return 0;
+    }
+
     // 1. initialize window
     is_running = initialize_window();
 
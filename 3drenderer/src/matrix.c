@@ -97,15 +97,26 @@ mat4_t mat4_mul_mat4(mat4_t a, mat4_t b) {
     mat4_t result;
     for (int i = 0; i < 4; i++) {
         for (int j = 0; j < 4; j++) {
-            for (int k = 0; k < 4; k++) {
-                result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] +
-                                 a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
-            }
+            result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] +
+                             a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
         }
     }
     return result;
 }
 
+/// @brief world matrix of an object, applying scale, then rotation around z,
+/// y and x, then translation: [T] * [Rx] * [Ry] * [Rz] * [S]
+mat4_t mat4_make_world(vec3_t scale, vec3_t rotation, vec3_t translation) {
+    mat4_t world = mat4_make_scale(scale.x, scale.y, scale.z);
+    world = mat4_mul_mat4(mat4_make_rotation_z(rotation.z), world);
+    world = mat4_mul_mat4(mat4_make_rotation_y(rotation.y), world);
+    world = mat4_mul_mat4(mat4_make_rotation_x(rotation.x), world);
+    world = mat4_mul_mat4(
+        mat4_make_translation(translation.x, translation.y, translation.z),
+        world);
+    return world;
+}
+
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar) {
     mat4_t m = {{{0}}};
     m.m[0][0] = aspect * (1 / tan(fov / 2));
@@ -132,19 +143,6 @@ mat4_t mat4_make_orthographic(float left, float right, float bottom, float top,
     return m;
 }
 
-vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v) {
-    // projection matrix multiplied with xyz1 vector
-    vec4_t result = mat4_mul_vec4(mat_proj, v);
-
-    // perspective divide
-    if (result.w != 0.0) {
-        result.x /= result.w;
-        result.y /= result.w;
-        result.z /= result.w;
-    }
-    return result;
-}
-
 mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up) {
     vec3_t z = vec3_sub(target, eye);
     vec3_normalize(&z);
@@ -16,10 +16,10 @@ mat4_t mat4_make_rotation_y(float angle);
 mat4_t mat4_make_rotation_z(float angle);
 vec4_t mat4_mul_vec4(mat4_t m, vec4_t v);
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
+mat4_t mat4_make_world(vec3_t scale, vec3_t rotation, vec3_t translation);
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar);
 mat4_t mat4_make_orthographic(float left, float right, float bottom, float top,
                               float znear, float zfar);
-vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v);
 
 // CAMERA
 mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up);
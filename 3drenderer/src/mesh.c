@@ -1,13 +1,21 @@
 #include "mesh.h"
 
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "array.h"
+#include "simplify.h"
+#include "threadpool.h"
 
-#define MAX_NUM_MESHES 10
-static mesh_t meshes[MAX_NUM_MESHES];
-static int mesh_count = 0;
+// Dynamic array of meshes, each allocated on its own so the pointers handed
+// out by get_mesh stay valid as the scene grows
+static mesh_t** meshes = NULL;
+
+// Indices of the meshes set_mesh_transform moved since the scene's tree last
+// caught up, each once
+static int* moved_meshes = NULL;
 
 void load_mesh_obj_data(mesh_t* mesh, char* obj_filename) {
     FILE* file;
@@ -54,40 +62,238 @@ void load_mesh_obj_data(mesh_t* mesh, char* obj_filename) {
     array_free(texcoords);
 }
 
+// Simplify the loaded faces level after level, appending each level's faces
+// to the face array, then group every level into meshlets
+static void build_mesh_lods(mesh_t* mesh) {
+    mesh_lod_t full = {.num_faces = array_length(mesh->faces)};
+    array_push(mesh->lods, full);
+    while (array_length(mesh->lods) < MAX_MESH_LODS) {
+        mesh_lod_t* previous = &mesh->lods[array_length(mesh->lods) - 1];
+        int target = previous->num_faces * LOD_FACE_RATIO;
+        if (target < MIN_LOD_FACES) break;
+
+        mesh_lod_t lod = {.first_face = array_length(mesh->faces)};
+        face_t* faces = simplify_faces(
+            mesh->vertices, &mesh->faces[previous->first_face],
+            previous->num_faces, target, &lod.error);
+        lod.num_faces = array_length(faces);
+        // Errors add up from level to level
+        lod.error += previous->error;
+        bool is_smaller = lod.num_faces < previous->num_faces * 0.75;
+        if (is_smaller) {
+            mesh->faces =
+                array_hold(mesh->faces, lod.num_faces, sizeof(face_t));
+            memcpy(&mesh->faces[lod.first_face], faces,
+                   lod.num_faces * sizeof(face_t));
+            array_push(mesh->lods, lod);
+        }
+        array_free(faces);
+        if (!is_smaller) break;
+    }
+
+    int num_lods = array_length(mesh->lods);
+    int level_faces[MAX_MESH_LODS];
+    for (int i = 0; i < num_lods; i++) {
+        level_faces[i] = mesh->lods[i].num_faces;
+    }
+    mesh->meshlets = build_meshlets(mesh->vertices, mesh->faces, num_lods,
+                                    level_faces, &mesh->meshlet_blocks);
+
+    // Meshlets come out level by level
+    int level = 0;
+    for (int i = 0; i < array_length(mesh->meshlets); i++) {
+        while (mesh->meshlets[i].first_face >=
+               mesh->lods[level].first_face + mesh->lods[level].num_faces) {
+            level++;
+            mesh->lods[level].first_meshlet = i;
+        }
+        mesh->lods[level].num_meshlets++;
+    }
+}
+
+// Plane of each face in model space: the unit normal get_triangle_normal
+// gives for its corners and the offset d with n . p + d = 0 on the face.
+// Degenerate faces get a zero plane, which no test culls
+static vec4_t* make_face_planes(vec3_t* vertices, face_t* faces) {
+    vec4_t* planes = NULL;
+    for (int i = 0; i < array_length(faces); i++) {
+        vec4_t corners[3] = {vec4_from_vec3(vertices[faces[i].a]),
+                             vec4_from_vec3(vertices[faces[i].b]),
+                             vec4_from_vec3(vertices[faces[i].c])};
+        vec3_t normal = get_triangle_normal(corners);
+        vec4_t plane = {0, 0, 0, 0};
+        if (!isnan(normal.x)) {
+            plane = (vec4_t){normal.x, normal.y, normal.z,
+                             -vec3_dot(normal, vertices[faces[i].a])};
+        }
+        array_push(planes, plane);
+    }
+    return planes;
+}
+
+// One mesh of a load_meshes call
+typedef struct {
+    mesh_t* mesh;
+    const mesh_file_t* file;
+    job_counter_t built;  // reading the file and building the levels
+} mesh_load_t;
+
+static void build_mesh_job(int index, void* context) {
+    mesh_load_t* load = &((mesh_load_t*)context)[index];
+    load_mesh_obj_data(load->mesh, load->file->obj_filename);
+    build_mesh_lods(load->mesh);
+}
+
+static void make_face_planes_job(int index, void* context) {
+    mesh_t* mesh = ((mesh_load_t*)context)[index].mesh;
+    mesh->face_planes = make_face_planes(mesh->vertices, mesh->faces);
+}
+
+static void make_position_blocks_job(int index, void* context) {
+    mesh_t* mesh = ((mesh_load_t*)context)[index].mesh;
+    mesh->positions =
+        make_position_blocks(mesh->vertices, array_length(mesh->vertices));
+    mesh->bounds = make_bounds(mesh->vertices, array_length(mesh->vertices));
+}
+
+static void decode_png_job(int index, void* context) {
+    mesh_load_t* load = &((mesh_load_t*)context)[index];
+    load_mesh_png_data(load->mesh, load->file->png_filename);
+}
+
+/// @brief load the meshes of the files side by side on the thread pool:
+/// each file's faces are read and simplified while its texture decodes,
+/// then its face planes and vertex blocks are made from the final vertex
+/// order. The meshes are added in the order of the files
+void load_meshes(const mesh_file_t* files, int num_files) {
+    mesh_load_t* loads = calloc(num_files, sizeof(mesh_load_t));
+    job_counter_t loaded = {0};
+    for (int i = 0; i < num_files; i++) {
+        loads[i].mesh = calloc(1, sizeof(mesh_t));
+        loads[i].file = &files[i];
+        add_job(build_mesh_job, i, loads, &loads[i].built, NULL);
+        add_job(make_face_planes_job, i, loads, &loaded, &loads[i].built);
+        add_job(make_position_blocks_job, i, loads, &loaded,
+                &loads[i].built);
+        add_job(decode_png_job, i, loads, &loaded, NULL);
+    }
+    wait_for_jobs(&loaded);
+
+    for (int i = 0; i < num_files; i++) {
+        mesh_t* mesh = loads[i].mesh;
+        mesh->scale = files[i].scale;
+        mesh->translation = files[i].translation;
+        mesh->rotation = files[i].rotation;
+        mesh->asset = array_length(meshes);
+        mesh->tint = 0xFFFFFFFF;
+        array_push(meshes, mesh);
+    }
+    free(loads);
+}
+
 void load_mesh(char* obj_filename, char* png_filename, vec3_t scale,
                vec3_t translation, vec3_t rotation) {
-    load_mesh_obj_data(&meshes[mesh_count], obj_filename);
-    load_mesh_png_data(&meshes[mesh_count], png_filename);
+    mesh_file_t file = {obj_filename, png_filename, scale, translation,
+                        rotation};
+    load_meshes(&file, 1);
+}
 
-    meshes[mesh_count].scale = scale;
-    meshes[mesh_count].translation = translation;
-    meshes[mesh_count].rotation = rotation;
+/// @brief add another instance of a loaded mesh. It shares the vertices,
+/// faces, meshlets and texture of mesh asset, so only its transform, tint
+/// and per-frame buffers take memory
+void add_mesh_instance(int asset, vec3_t scale, vec3_t translation,
+                       vec3_t rotation, uint32_t tint) {
+    // Instances of instances share the loaded mesh as well
+    mesh_t* source = meshes[meshes[asset]->asset];
+    mesh_t* mesh = calloc(1, sizeof(mesh_t));
+    mesh->vertices = source->vertices;
+    mesh->faces = source->faces;
+    mesh->face_planes = source->face_planes;
+    mesh->lods = source->lods;
+    mesh->texture = source->texture;
+    mesh->bounds = source->bounds;
+    mesh->meshlets = source->meshlets;
+    mesh->meshlet_blocks = source->meshlet_blocks;
+    mesh->positions = source->positions;
+    mesh->asset = source->asset;
 
-    mesh_count++;
+    mesh->scale = scale;
+    mesh->translation = translation;
+    mesh->rotation = rotation;
+    mesh->tint = tint;
+
+    array_push(meshes, mesh);
 }
 
 void load_mesh_png_data(mesh_t* mesh, char* png_filename) {
+    // Untextured meshes pass no file
+    if (png_filename == NULL) return;
+
     upng_t* png_image = upng_new_from_file(png_filename);
     if (png_image != NULL) {
         upng_decode(png_image);
         if (upng_get_error(png_image) == UPNG_EOK) {
-            mesh->texture = png_image;
+            // Keep only the converted texture, the decoded PNG is not needed
+            // anymore
+            mesh->texture = texture_from_png(png_image);
+            if (mesh->texture == NULL) {
+                printf("Unsupported PNG format: %s\n", png_filename);
+            }
         } else {
             printf("Error decoding PNG: %s\n", png_filename);  // Debug print
         }
+        upng_free(png_image);
     } else {
         printf("Failed to load PNG file: %s\n", png_filename);  // Debug print
     }
 }
 
-mesh_t* get_mesh(int index) { return &meshes[index]; }
+mesh_t* get_mesh(int index) { return meshes[index]; }
+
+/// @brief place the mesh anew. Whatever moves a mesh goes through here, so
+/// the scene's tree only refits the meshes that moved
+void set_mesh_transform(int index, vec3_t scale, vec3_t translation,
+                        vec3_t rotation) {
+    mesh_t* mesh = meshes[index];
+    mesh->scale = scale;
+    mesh->translation = translation;
+    mesh->rotation = rotation;
+    if (!mesh->has_moved) {
+        mesh->has_moved = true;
+        array_push(moved_meshes, index);
+    }
+}
+
+/// @brief meshes moved since the last clear_moved_meshes; the size is
+/// array_length
+int* get_moved_meshes(void) { return moved_meshes; }
+
+void clear_moved_meshes(void) {
+    for (int i = 0; i < array_length(moved_meshes); i++) {
+        meshes[moved_meshes[i]]->has_moved = false;
+    }
+    array_clear(moved_meshes);
+}
 
 void free_meshes(void) {
-    for (int i = 0; i < mesh_count; i++) {
-        upng_free(meshes[i].texture);
-        array_free(meshes[i].faces);
-        array_free(meshes[i].vertices);
+    for (int i = 0; i < array_length(meshes); i++) {
+        // Data shared with instances goes with the mesh that loaded it
+        if (meshes[i]->asset == i) {
+            free_texture(meshes[i]->texture);
+            array_free(meshes[i]->faces);
+            array_free(meshes[i]->face_planes);
+            array_free(meshes[i]->lods);
+            array_free(meshes[i]->vertices);
+            array_free(meshes[i]->positions);
+            array_free(meshes[i]->meshlets);
+            array_free(meshes[i]->meshlet_blocks);
+        }
+        free(meshes[i]);
     }
+    array_free(meshes);
+    array_free(moved_meshes);
+    meshes = NULL;
+    moved_meshes = NULL;
 }
 
-int get_num_meshes(void) { return mesh_count; }
+int get_num_meshes(void) { return array_length(meshes); }
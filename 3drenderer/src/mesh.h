@@ -1,27 +1,73 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include "clipping.h"
+#include "meshlet.h"
+#include "texture.h"
+#include "transform.h"
 #include "triangle.h"
-#include "upng.h"
 #include "vector.h"
 
+// Levels of detail per mesh, the full mesh included
+#define MAX_MESH_LODS 5
+
+// Each level keeps about this fraction of the faces of the one before, and
+// levels stop once they would get below MIN_LOD_FACES or barely shrink
+#define LOD_FACE_RATIO 0.5
+#define MIN_LOD_FACES 32
+
+// A level of detail: a run of the mesh's faces, and the meshlets over them
+typedef struct {
+    int first_face;     // the levels follow one another in the face array
+    int num_faces;
+    int first_meshlet;  // and in the meshlet array
+    int num_meshlets;
+    float error;        // model-space distance the surface moved by, at most
+} mesh_lod_t;
+
 /// @brief Struct for dynamic size meshes with array of vertices and faces
 typedef struct {
-    vec3_t* vertices;    // dynamic array of vertices
-    face_t* faces;       // dynamic array of faces
-    upng_t* texture;     // mesh PNG texture pointer
-    vec3_t rotation;     // euler rotation with x, y, and z values
-    vec3_t scale;        // scale with x, y, z values
-    vec3_t translation;  // translation with x, y, z values
+    vec3_t* vertices;             // dynamic array of vertices
+    face_t* faces;                // dynamic array of faces, every level
+    vec4_t* face_planes;          // model-space plane of each face
+    mesh_lod_t* lods;             // the full mesh, then coarser levels
+    texture_t* texture;           // texture converted at load time
+    bounds_t bounds;              // model-space box and sphere of the vertices
+    meshlet_t* meshlets;          // clusters of faces culled as a whole
+    int* meshlet_blocks;          // vertex blocks read by each meshlet
+    position_block_t* positions;  // vertices in blocks for the transform
+    vec3_t rotation;              // euler rotation with x, y, and z values
+    vec3_t scale;                 // scale with x, y, z values
+    vec3_t translation;           // translation with x, y, z values
+    bool has_moved;               // listed by set_mesh_transform
+    bool is_occluder;             // drawn into the occlusion buffer first
+    int asset;                    // mesh whose data this one shares, or itself
+    uint32_t tint;                // multiplies the face colors
 } mesh_t;
 
+// A mesh to load from its files, and where to put it
+typedef struct {
+    char* obj_filename;
+    char* png_filename;  // NULL for untextured meshes
+    vec3_t scale;
+    vec3_t translation;
+    vec3_t rotation;
+} mesh_file_t;
+
 void load_mesh_obj_data(mesh_t* mesh, char* obj_filename);
 void load_mesh_png_data(mesh_t* mesh, char* png_filename);
 void load_mesh(char* obj_filename, char* png_filename, vec3_t scale,
                vec3_t translation, vec3_t rotation);
+void load_meshes(const mesh_file_t* files, int num_files);
+void add_mesh_instance(int asset, vec3_t scale, vec3_t translation,
+                       vec3_t rotation, uint32_t tint);
 
 int get_num_meshes(void);
 mesh_t* get_mesh(int index);
+void set_mesh_transform(int index, vec3_t scale, vec3_t translation,
+                        vec3_t rotation);
+int* get_moved_meshes(void);
+void clear_moved_meshes(void);
 void free_meshes(void);
 
 #endif
\ No newline at end of file
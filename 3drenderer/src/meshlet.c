@@ -0,0 +1,242 @@
+#include "meshlet.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "transform.h"
+
+static int compare_ints(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+// Whether a face's normal is close enough to the average of a meshlet's
+static bool is_normal_close(vec3_t normal, vec3_t normal_sum) {
+    float length = vec3_length(normal_sum);
+    return length == 0 ||
+           vec3_dot(normal, normal_sum) >= MESHLET_MIN_NORMAL_DOT * length;
+}
+
+// Faces are grown into meshlets breadth first over shared vertices, so every
+// meshlet is a connected patch of the surface. The num_faces faces starting
+// at faces[first_face] are grouped among themselves and their meshlets added
+// to meshlets
+static void group_faces(vec3_t* vertices, face_t* mesh_faces, int first_face,
+                        int num_faces, meshlet_t** meshlets) {
+    face_t* faces = &mesh_faces[first_face];
+    int num_vertices = array_length(vertices);
+    vec3_t* normals = malloc(num_faces * sizeof(vec3_t));
+    for (int i = 0; i < num_faces; i++) {
+        vec4_t face_vertices[3] = {vec4_from_vec3(vertices[faces[i].a]),
+                                   vec4_from_vec3(vertices[faces[i].b]),
+                                   vec4_from_vec3(vertices[faces[i].c])};
+        normals[i] = get_triangle_normal(face_vertices);
+        if (isnan(normals[i].x)) {  // degenerate faces have no normal
+            normals[i] = vec3_new(0, 0, 0);
+        }
+    }
+
+    // Faces around each vertex, counted, then listed
+    int* first_vertex_face = calloc(num_vertices + 1, sizeof(int));
+    int* vertex_faces = malloc(num_faces * 3 * sizeof(int));
+    for (int i = 0; i < num_faces; i++) {
+        first_vertex_face[faces[i].a + 1]++;
+        first_vertex_face[faces[i].b + 1]++;
+        first_vertex_face[faces[i].c + 1]++;
+    }
+    for (int i = 0; i < num_vertices; i++) {
+        first_vertex_face[i + 1] += first_vertex_face[i];
+    }
+    int* fill = malloc(num_vertices * sizeof(int));
+    memcpy(fill, first_vertex_face, num_vertices * sizeof(int));
+    for (int i = 0; i < num_faces; i++) {
+        vertex_faces[fill[faces[i].a]++] = i;
+        vertex_faces[fill[faces[i].b]++] = i;
+        vertex_faces[fill[faces[i].c]++] = i;
+    }
+
+    // The queue holds the faces of the meshlet being grown in the order they
+    // were reached, which is also their new order in the mesh
+    bool* is_grouped = calloc(num_faces, sizeof(bool));
+    int* order = malloc(num_faces * sizeof(int));
+    int num_ordered = 0;
+    for (int seed = 0; seed < num_faces; seed++) {
+        if (is_grouped[seed]) continue;
+
+        meshlet_t meshlet = {.first_face = num_ordered};
+        int next = num_ordered;
+        order[num_ordered++] = seed;
+        is_grouped[seed] = true;
+        vec3_t normal_sum = normals[seed];
+        while (next < num_ordered &&
+               num_ordered - meshlet.first_face < MESHLET_MAX_FACES) {
+            face_t face = faces[order[next++]];
+            int corners[3] = {face.a, face.b, face.c};
+            for (int j = 0; j < 3; j++) {
+                int vertex = corners[j];
+                for (int k = first_vertex_face[vertex];
+                     k < first_vertex_face[vertex + 1]; k++) {
+                    int neighbour = vertex_faces[k];
+                    if (!is_grouped[neighbour] &&
+                        num_ordered - meshlet.first_face < MESHLET_MAX_FACES &&
+                        is_normal_close(normals[neighbour], normal_sum)) {
+                        order[num_ordered++] = neighbour;
+                        is_grouped[neighbour] = true;
+                        normal_sum = vec3_add(normal_sum, normals[neighbour]);
+                    }
+                }
+            }
+        }
+        meshlet.num_faces = num_ordered - meshlet.first_face;
+        meshlet.first_face += first_face;
+        array_push(*meshlets, meshlet);
+    }
+
+    face_t* grouped = malloc(num_faces * sizeof(face_t));
+    for (int i = 0; i < num_faces; i++) {
+        grouped[i] = faces[order[i]];
+    }
+    memcpy(faces, grouped, num_faces * sizeof(face_t));
+
+    free(grouped);
+    free(order);
+    free(is_grouped);
+    free(fill);
+    free(vertex_faces);
+    free(first_vertex_face);
+    free(normals);
+}
+
+// Vertices are renumbered in the order the grouped faces first use them, so
+// each meshlet's vertices share few blocks of the transform
+static void sort_vertices_by_use(vec3_t* vertices, face_t* faces) {
+    int num_vertices = array_length(vertices);
+    int* new_index = malloc(num_vertices * sizeof(int));
+    for (int i = 0; i < num_vertices; i++) {
+        new_index[i] = -1;
+    }
+
+    vec3_t* sorted = malloc(num_vertices * sizeof(vec3_t));
+    int num_sorted = 0;
+    for (int i = 0; i < array_length(faces); i++) {
+        int* corners[3] = {&faces[i].a, &faces[i].b, &faces[i].c};
+        for (int j = 0; j < 3; j++) {
+            int vertex = *corners[j];
+            if (new_index[vertex] < 0) {
+                new_index[vertex] = num_sorted;
+                sorted[num_sorted++] = vertices[vertex];
+            }
+            *corners[j] = new_index[vertex];
+        }
+    }
+    // Vertices no face uses go last
+    for (int i = 0; i < num_vertices; i++) {
+        if (new_index[i] < 0) {
+            sorted[num_sorted++] = vertices[i];
+        }
+    }
+    memcpy(vertices, sorted, num_vertices * sizeof(vec3_t));
+
+    free(sorted);
+    free(new_index);
+}
+
+/// @brief split the faces into meshlets of up to MESHLET_MAX_FACES, grouping
+/// the faces and renumbering the vertices in place. The faces come in
+/// num_levels runs of level_faces[i] faces, one after the other, and no
+/// meshlet spans two runs. blocks receives the vertex blocks each meshlet
+/// reads, see meshlet_t
+meshlet_t* build_meshlets(vec3_t* vertices, face_t* faces, int num_levels,
+                          const int* level_faces, int** blocks) {
+    meshlet_t* meshlets = NULL;
+    int first_face = 0;
+    for (int i = 0; i < num_levels; i++) {
+        group_faces(vertices, faces, first_face, level_faces[i], &meshlets);
+        first_face += level_faces[i];
+    }
+    // The first run decides the order, the others use a subset of its
+    // vertices
+    sort_vertices_by_use(vertices, faces);
+
+    vec3_t* points = NULL;
+    int* meshlet_blocks = NULL;
+    for (int m = 0; m < array_length(meshlets); m++) {
+        meshlet_t* meshlet = &meshlets[m];
+        array_clear(points);
+        array_clear(meshlet_blocks);
+
+        vec3_t normal_sum = {0, 0, 0};
+        for (int i = meshlet->first_face;
+             i < meshlet->first_face + meshlet->num_faces; i++) {
+            int corners[3] = {faces[i].a, faces[i].b, faces[i].c};
+            vec4_t face_vertices[3];
+            for (int j = 0; j < 3; j++) {
+                array_push(points, vertices[corners[j]]);
+                array_push(meshlet_blocks, corners[j] / VERTEX_BLOCK_SIZE);
+                face_vertices[j] = vec4_from_vec3(vertices[corners[j]]);
+            }
+            vec3_t normal = get_triangle_normal(face_vertices);
+            if (!isnan(normal.x)) {  // degenerate faces have no normal
+                normal_sum = vec3_add(normal_sum, normal);
+            }
+        }
+        meshlet->bounds = make_bounds(points, array_length(points));
+
+        // The cone holds every face normal; faces without a normal take up
+        // no area and can go with any cone
+        meshlet->cone_axis = normal_sum;
+        meshlet->cone_cutoff = MESHLET_NO_CONE;
+        if (vec3_length(normal_sum) > 0) {
+            vec3_normalize(&meshlet->cone_axis);
+            float min_dot = 1.0;
+            for (int i = meshlet->first_face;
+                 i < meshlet->first_face + meshlet->num_faces; i++) {
+                vec4_t face_vertices[3] = {
+                    vec4_from_vec3(vertices[faces[i].a]),
+                    vec4_from_vec3(vertices[faces[i].b]),
+                    vec4_from_vec3(vertices[faces[i].c])};
+                vec3_t normal = get_triangle_normal(face_vertices);
+                if (!isnan(normal.x)) {
+                    float dot = vec3_dot(normal, meshlet->cone_axis);
+                    min_dot = fmin(min_dot, dot);
+                }
+            }
+            if (min_dot > 0) {
+                meshlet->cone_cutoff = sqrt(1 - min_dot * min_dot);
+            }
+        }
+
+        // Each block the meshlet reads, once
+        int num_entries = array_length(meshlet_blocks);
+        qsort(meshlet_blocks, num_entries, sizeof(int), compare_ints);
+        meshlet->first_block = array_length(*blocks);
+        for (int i = 0; i < num_entries; i++) {
+            if (i == 0 || meshlet_blocks[i] != meshlet_blocks[i - 1]) {
+                array_push(*blocks, meshlet_blocks[i]);
+            }
+        }
+        meshlet->num_blocks = array_length(*blocks) - meshlet->first_block;
+    }
+    array_free(points);
+    array_free(meshlet_blocks);
+    return meshlets;
+}
+
+/// @brief whether every face of the meshlet faces away from the camera, in
+/// model space. In perspective the camera sits at camera_position, in
+/// orthographic it looks along view_direction
+bool is_meshlet_back_facing(const meshlet_t* meshlet, vec3_t camera_position,
+                            vec3_t view_direction, bool orthographic) {
+    if (meshlet->cone_cutoff >= 1.0) return false;
+    if (orthographic) {
+        return vec3_dot(meshlet->cone_axis, view_direction) >
+               meshlet->cone_cutoff;
+    }
+    // The cone pointing away by more than its half angle from every point
+    // of the bounding sphere
+    vec3_t to_center = vec3_sub(meshlet->bounds.center, camera_position);
+    return vec3_dot(to_center, meshlet->cone_axis) >
+           meshlet->cone_cutoff * vec3_length(to_center) +
+               meshlet->bounds.radius;
+}
@@ -0,0 +1,37 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "clipping.h"
+#include "triangle.h"
+#include "vector.h"
+
+// Faces per meshlet: small enough for tight bounds and normal cones, large
+// enough for the per-meshlet tests to pay off
+#define MESHLET_MAX_FACES 64
+
+// Faces only join a meshlet with normals this close to the meshlet's
+// average (cosine of the angle), keeping the cones narrow enough to cull on
+// curved surfaces at the cost of smaller meshlets there
+#define MESHLET_MIN_NORMAL_DOT 0.8
+
+// Cone cutoff of meshlets whose faces point too many ways to ever be culled
+#define MESHLET_NO_CONE 2.0
+
+// A cluster of neighbouring faces, culled as a whole against the view volume
+// and, through the cone around its face normals, as back-facing
+typedef struct {
+    int first_face;     // the faces of a meshlet are contiguous in the mesh
+    int num_faces;
+    int first_block;    // entries in the mesh's list of meshlet vertex blocks
+    int num_blocks;
+    bounds_t bounds;    // model-space box and sphere of its vertices
+    vec3_t cone_axis;   // average direction of its face normals
+    float cone_cutoff;  // sine of the widest normal to axis angle
+} meshlet_t;
+
+meshlet_t* build_meshlets(vec3_t* vertices, face_t* faces, int num_levels,
+                          const int* level_faces, int** blocks);
+bool is_meshlet_back_facing(const meshlet_t* meshlet, vec3_t camera_position,
+                            vec3_t view_direction, bool orthographic);
+
+#endif
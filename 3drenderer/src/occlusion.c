@@ -0,0 +1,152 @@
+#include "occlusion.h"
+
+#include <float.h>
+#include <math.h>
+
+// Normalized device depth (z / w) of the occluders, 0 at the near plane and
+// 1 at the far one in both projections. Cleared to FLT_MAX, nothing drawn
+static float depth_buffer[OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT];
+static bool has_occluders = false;
+static bool occlusion_culling_enabled = true;
+
+static int num_occlusion_culled = 0;
+static int num_occlusion_visible = 0;
+
+void set_occlusion_culling(bool enabled) {
+    occlusion_culling_enabled = enabled;
+}
+bool is_occlusion_culling_enabled(void) { return occlusion_culling_enabled; }
+
+/// @brief start a frame: no occluders and no tests so far. The depths are
+/// only cleared once the first occluder is drawn
+void clear_occlusion_buffer(void) {
+    has_occluders = false;
+    num_occlusion_culled = 0;
+    num_occlusion_visible = 0;
+}
+
+static float edge_function(float ax, float ay, float bx, float by, float px,
+                           float py) {
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+/// @brief rasterize a clip-space triangle of an occluder, depth only. Pixels
+/// are covered when their center is, and the whole triangle is written at
+/// the depth of its farthest vertex, so it never hides more than it should
+void draw_occluder_triangle(vec4_t clip_vertices[3]) {
+    if (!has_occluders) {
+        for (int i = 0; i < OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT;
+             i++) {
+            depth_buffer[i] = FLT_MAX;
+        }
+        has_occluders = true;
+    }
+
+    float x[3];
+    float y[3];
+    float depth = 0;
+    for (int i = 0; i < 3; i++) {
+        // Triangles reaching behind the near plane are left out, occluding
+        // less is always safe
+        vec4_t v = clip_vertices[i];
+        if (v.z < 0 || v.w <= 0) return;
+        x[i] = (v.x / v.w * 0.5 + 0.5) * OCCLUSION_BUFFER_WIDTH;
+        y[i] = (0.5 - v.y / v.w * 0.5) * OCCLUSION_BUFFER_HEIGHT;
+        depth = fmax(depth, v.z / v.w);
+    }
+
+    // Either winding, the edge functions are positive inside
+    float area = edge_function(x[0], y[0], x[1], y[1], x[2], y[2]);
+    if (area == 0) return;
+    if (area < 0) {
+        float t = x[1];
+        x[1] = x[2];
+        x[2] = t;
+        t = y[1];
+        y[1] = y[2];
+        y[2] = t;
+    }
+
+    // Pixels whose centers are inside the bounding box
+    int x_min = fmax(ceil(fmin(x[0], fmin(x[1], x[2])) - 0.5), 0);
+    int x_max = fmin(floor(fmax(x[0], fmax(x[1], x[2])) - 0.5),
+                     OCCLUSION_BUFFER_WIDTH - 1);
+    int y_min = fmax(ceil(fmin(y[0], fmin(y[1], y[2])) - 0.5), 0);
+    int y_max = fmin(floor(fmax(y[0], fmax(y[1], y[2])) - 0.5),
+                     OCCLUSION_BUFFER_HEIGHT - 1);
+
+    for (int py = y_min; py <= y_max; py++) {
+        float cy = py + 0.5;
+        float cx = x_min + 0.5;
+        float w0 = edge_function(x[1], y[1], x[2], y[2], cx, cy);
+        float w1 = edge_function(x[2], y[2], x[0], y[0], cx, cy);
+        float w2 = edge_function(x[0], y[0], x[1], y[1], cx, cy);
+        float* row = &depth_buffer[py * OCCLUSION_BUFFER_WIDTH];
+        for (int px = x_min; px <= x_max; px++) {
+            if (w0 >= 0 && w1 >= 0 && w2 >= 0 && depth < row[px]) {
+                row[px] = depth;
+            }
+            w0 -= y[2] - y[1];
+            w1 -= y[0] - y[2];
+            w2 -= y[1] - y[0];
+        }
+    }
+}
+
+/// @brief whether the occluders drawn so far hide the bounds: every pixel
+/// under their screen rectangle holds an occluder nearer than the nearest
+/// corner. The rectangle is grown by a pixel to make up for occluders being
+/// sampled at pixel centers
+bool is_bounds_occluded(const mat4_t* mvp, bounds_t bounds) {
+    if (!has_occluders) {
+        num_occlusion_visible++;
+        return false;
+    }
+
+    float x_min = FLT_MAX;
+    float x_max = -FLT_MAX;
+    float y_min = FLT_MAX;
+    float y_max = -FLT_MAX;
+    float nearest = FLT_MAX;
+    for (int i = 0; i < 8; i++) {
+        vec4_t corner = {i & 1 ? bounds.max.x : bounds.min.x,
+                         i & 2 ? bounds.max.y : bounds.min.y,
+                         i & 4 ? bounds.max.z : bounds.min.z, 1};
+        vec4_t v = mat4_mul_vec4(*mvp, corner);
+        // Bounds reaching behind the near plane cover the view
+        if (v.z < 0 || v.w <= 0) {
+            num_occlusion_visible++;
+            return false;
+        }
+        float x = (v.x / v.w * 0.5 + 0.5) * OCCLUSION_BUFFER_WIDTH;
+        float y = (0.5 - v.y / v.w * 0.5) * OCCLUSION_BUFFER_HEIGHT;
+        x_min = fmin(x_min, x);
+        x_max = fmax(x_max, x);
+        y_min = fmin(y_min, y);
+        y_max = fmax(y_max, y);
+        nearest = fmin(nearest, v.z / v.w);
+    }
+
+    int rect_x_min = fmax(floor(x_min) - 1, 0);
+    int rect_x_max = fmin(floor(x_max) + 1, OCCLUSION_BUFFER_WIDTH - 1);
+    int rect_y_min = fmax(floor(y_min) - 1, 0);
+    int rect_y_max = fmin(floor(y_max) + 1, OCCLUSION_BUFFER_HEIGHT - 1);
+    if (rect_x_min > rect_x_max || rect_y_min > rect_y_max) {
+        num_occlusion_visible++;
+        return false;
+    }
+    for (int py = rect_y_min; py <= rect_y_max; py++) {
+        float* row = &depth_buffer[py * OCCLUSION_BUFFER_WIDTH];
+        for (int px = rect_x_min; px <= rect_x_max; px++) {
+            if (row[px] >= nearest) {
+                num_occlusion_visible++;
+                return false;
+            }
+        }
+    }
+    num_occlusion_culled++;
+    return true;
+}
+
+int get_num_occlusion_culled(void) { return num_occlusion_culled; }
+int get_num_occlusion_visible(void) { return num_occlusion_visible; }
@@ -0,0 +1,25 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stdbool.h>
+
+#include "clipping.h"
+#include "matrix.h"
+#include "vector.h"
+
+// The occluder depth buffer covers the whole viewport at a fraction of its
+// resolution, so rasterizing occluders and testing bounds stays cheap
+#define OCCLUSION_BUFFER_WIDTH 256
+#define OCCLUSION_BUFFER_HEIGHT 128
+
+void set_occlusion_culling(bool enabled);
+bool is_occlusion_culling_enabled(void);
+
+void clear_occlusion_buffer(void);
+void draw_occluder_triangle(vec4_t clip_vertices[3]);
+bool is_bounds_occluded(const mat4_t* mvp, bounds_t bounds);
+
+int get_num_occlusion_culled(void);
+int get_num_occlusion_visible(void);
+
+#endif
@@ -0,0 +1,149 @@
+#include "rasterizer.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// A vertex snapped to the subpixel grid
+typedef struct {
+    int x;
+    int y;
+} subpixel_t;
+
+static subpixel_t snap_to_subpixel(vec2_t v) {
+    subpixel_t p = {round(v.x * SUBPIXEL_ONE), round(v.y * SUBPIXEL_ONE)};
+    return p;
+}
+
+static edge_t edge_from_points(subpixel_t from, subpixel_t to) {
+    // E(p) = (to - from) x (p - from), expanded into a*x + b*y + c over whole
+    // pixels so the pixel loop can step it with a single add per pixel. The
+    // center of pixel x lies at x * SUBPIXEL_ONE + SUBPIXEL_ONE / 2
+    int dy = from.y - to.y;
+    int dx = to.x - from.x;
+    int half = SUBPIXEL_ONE / 2;
+    edge_t edge = {.a = dy * SUBPIXEL_ONE,
+                   .b = dx * SUBPIXEL_ONE,
+                   .c = (int64_t)dy * (half - from.x) +
+                        (int64_t)dx * (half - from.y)};
+    return edge;
+}
+
+/// @brief the edge function at pixel (x, y), clamped to EDGE_CLAMP either
+/// way so the span kernels can step it in 32 bits, see EDGE_CLAMP
+int edge_evaluate(edge_t edge, int x, int y) {
+    int64_t e = (int64_t)edge.a * x + (int64_t)edge.b * y + edge.c;
+    if (e > EDGE_CLAMP) return EDGE_CLAMP;
+    if (e < -EDGE_CLAMP) return -EDGE_CLAMP;
+    return e;
+}
+
+bool raster_setup_triangle(raster_triangle_t* triangle, vec2_t a, vec2_t b,
+                           vec2_t c, raster_rect_t scissor) {
+    subpixel_t p0 = snap_to_subpixel(a);
+    subpixel_t p1 = snap_to_subpixel(b);
+    subpixel_t p2 = snap_to_subpixel(c);
+
+    int min_x = fmin(p0.x, fmin(p1.x, p2.x));
+    int min_y = fmin(p0.y, fmin(p1.y, p2.y));
+    int max_x = fmax(p0.x, fmax(p1.x, p2.x));
+    int max_y = fmax(p0.y, fmax(p1.y, p2.y));
+
+    triangle->edges[0] = edge_from_points(p1, p2);
+    triangle->edges[1] = edge_from_points(p2, p0);
+    triangle->edges[2] = edge_from_points(p0, p1);
+
+    // Evaluating the edge opposite A at A gives twice the signed area
+    long long area = (long long)(p1.y - p2.y) * (p0.x - p1.x) +
+                     (long long)(p2.x - p1.x) * (p0.y - p1.y);
+
+    // Safety exit if triangle is degenerate
+    if (area == 0) {
+        return false;
+    }
+
+    // Flip counter-clockwise triangles so the inside test is always >= 0
+    if (area < 0) {
+        for (int i = 0; i < 3; i++) {
+            triangle->edges[i].a = -triangle->edges[i].a;
+            triangle->edges[i].b = -triangle->edges[i].b;
+            triangle->edges[i].c = -triangle->edges[i].c;
+        }
+        area = -area;
+    }
+    triangle->area = area;
+
+    // Top-left rule: a pixel center exactly on an edge belongs to the
+    // triangle only if that edge is a left edge (the inside is to its right)
+    // or a top edge (horizontal with the inside below it). The two triangles
+    // sharing an edge see it from opposite sides, so exactly one of them
+    // draws those pixels. Other edges are pulled in by one unit, which turns
+    // E >= 0 into E > 0 for them
+    for (int i = 0; i < 3; i++) {
+        edge_t* edge = &triangle->edges[i];
+        bool is_top_left = edge->a > 0 || (edge->a == 0 && edge->b > 0);
+        triangle->bias[i] = is_top_left ? 0 : 1;
+        edge->c -= triangle->bias[i];
+    }
+
+    // Pixels whose centers fall inside the vertices' bounding box, clipped
+    // against the scissor rect
+    double half = SUBPIXEL_ONE / 2;
+    raster_rect_t bounds = {
+        .min_x = ceil((min_x - half) / SUBPIXEL_ONE),
+        .min_y = ceil((min_y - half) / SUBPIXEL_ONE),
+        .max_x = floor((max_x - half) / SUBPIXEL_ONE),
+        .max_y = floor((max_y - half) / SUBPIXEL_ONE),
+    };
+    if (bounds.min_x < scissor.min_x) bounds.min_x = scissor.min_x;
+    if (bounds.min_y < scissor.min_y) bounds.min_y = scissor.min_y;
+    if (bounds.max_x > scissor.max_x) bounds.max_x = scissor.max_x;
+    if (bounds.max_y > scissor.max_y) bounds.max_y = scissor.max_y;
+    triangle->bounds = bounds;
+    if (bounds.min_x > bounds.max_x || bounds.min_y > bounds.max_y) {
+        return false;
+    }
+
+    // Stepping the edges across the bounds, past the end of the spans and
+    // one row past the last, has to stay within EDGE_CLAMP. Tile-sized
+    // scissor rects always do for triangles inside the guard band, see
+    // tile.c
+    int64_t columns = bounds.max_x - bounds.min_x + 1 + SPAN_OVERSHOOT;
+    int64_t rows = bounds.max_y - bounds.min_y + 2;
+    for (int i = 0; i < 3; i++) {
+        edge_t* edge = &triangle->edges[i];
+        if (llabs(edge->a) * columns + llabs(edge->b) * rows >= EDGE_CLAMP) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief plane of the attribute whose values at vertices A, B and C are a0,
+/// a1 and a2, built from the edge equations that give the barycentrics
+attribute_plane_t raster_attribute_plane(const raster_triangle_t* triangle,
+                                         float a0, float a1, float a2) {
+    const edge_t* edges = triangle->edges;
+
+    // value = a0*alpha + a1*beta + a2*gamma, where every weight is an edge
+    // function (without its fill rule bias) over the area, so the weighted
+    // edges add up to one plane. Work in double since c extrapolates the
+    // attribute all the way back to the screen origin
+    double area = triangle->area;
+    double c0 = (double)edges[0].c + triangle->bias[0];
+    double c1 = (double)edges[1].c + triangle->bias[1];
+    double c2 = (double)edges[2].c + triangle->bias[2];
+    attribute_plane_t plane = {
+        .dx = ((double)a0 * edges[0].a + (double)a1 * edges[1].a +
+               (double)a2 * edges[2].a) /
+              area,
+        .dy = ((double)a0 * edges[0].b + (double)a1 * edges[1].b +
+               (double)a2 * edges[2].b) /
+              area,
+        .c = (a0 * c0 + a1 * c1 + a2 * c2) / area,
+    };
+    return plane;
+}
+
+float attribute_evaluate(attribute_plane_t plane, float x, float y) {
+    return plane.dx * x + plane.dy * y + plane.c;
+}
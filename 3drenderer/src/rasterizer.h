@@ -0,0 +1,70 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vector.h"
+
+// Vertices are snapped to 28.4 fixed point, i.e. 1/16 of a pixel, before the
+// edge equations are set up, so the edge functions are exact integers
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+
+// The guard band keeps clipped triangles within MAX_RASTER_EXTENT pixels, or
+// the window when it is larger
+#define MAX_RASTER_EXTENT 2048
+
+// Edge functions are evaluated in 64 bits where a span starts and stepped in
+// 32 bits along it. Starting values beyond EDGE_CLAMP either way are clamped
+// to it, which keeps their sign as long as stepping across the scissored
+// bounds changes an edge by less than EDGE_CLAMP; triangles that would step
+// further are not set up
+#define EDGE_CLAMP (1 << 30)
+
+// Pixels the span kernels may step past the end of a span, one SIMD vector
+#define SPAN_OVERSHOOT 8
+
+// Edge equation E(x, y) = a*x + b*y + c, evaluated at the center of pixel
+// (x, y). After setup every edge is positive on the inside of the triangle,
+// and zero on the edge only for top and left edges (the top-left fill rule)
+typedef struct {
+    int a;      // change of E per pixel step in x
+    int b;      // change of E per pixel step in y
+    int64_t c;  // E at pixel (0, 0), which may lie far off the triangle
+} edge_t;
+
+// Inclusive pixel rectangle used for bounding boxes and scissoring
+typedef struct {
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+} raster_rect_t;
+
+// Per-triangle data computed once before walking any pixel
+typedef struct {
+    // edges[0] is opposite vertex A and yields alpha, edges[1] is opposite B
+    // and yields beta, edges[2] is opposite C and yields gamma
+    edge_t edges[3];
+    int bias[3];           // fill rule offsets folded into each edge's c
+    float area;            // twice the triangle area, in edge function units
+    raster_rect_t bounds;  // covered pixels clipped to the scissor rect
+} raster_triangle_t;
+
+// Screen-space plane of an attribute that is linear across the triangle,
+// value(x, y) = dx*x + dy*y + c, so stepping one pixel is a single add
+typedef struct {
+    float dx;
+    float dy;
+    float c;
+} attribute_plane_t;
+
+bool raster_setup_triangle(raster_triangle_t* triangle, vec2_t a, vec2_t b,
+                           vec2_t c, raster_rect_t scissor);
+int edge_evaluate(edge_t edge, int x, int y);
+attribute_plane_t raster_attribute_plane(const raster_triangle_t* triangle,
+                                         float a0, float a1, float a2);
+float attribute_evaluate(attribute_plane_t plane, float x, float y);
+
+#endif
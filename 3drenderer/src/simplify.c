@@ -0,0 +1,304 @@
+#include "simplify.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+
+// Symmetric 4x4 matrix of a quadric, the upper triangle row by row. Applied
+// to a point it gives the sum of its squared distances to a set of planes,
+// divided by their weight the mean squared distance
+typedef struct {
+    double m[10];
+    double weight;  // of the face planes, boundary planes only add a penalty
+} quadric_t;
+
+// Collapsing the edge moves vertex from onto vertex to
+typedef struct {
+    int from;
+    int to;
+    double cost;  // quadric error of the merged vertex
+} collapse_t;
+
+static void quadric_add_plane(quadric_t* q, vec3_t normal, double offset,
+                              double weight) {
+    double plane[4] = {normal.x, normal.y, normal.z, offset};
+    int k = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int j = i; j < 4; j++) {
+            q->m[k++] += weight * plane[i] * plane[j];
+        }
+    }
+}
+
+static void quadric_add(quadric_t* q, const quadric_t* other) {
+    for (int i = 0; i < 10; i++) {
+        q->m[i] += other->m[i];
+    }
+    q->weight += other->weight;
+}
+
+static double quadric_error(const quadric_t* q, vec3_t v) {
+    const double* m = q->m;
+    double x = v.x;
+    double y = v.y;
+    double z = v.z;
+    double error = m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z +
+                   2 * m[3] * x + m[4] * y * y + 2 * m[5] * y * z +
+                   2 * m[6] * y + m[7] * z * z + 2 * m[8] * z + m[9];
+    return error > 0 && q->weight > 0 ? error / q->weight : 0;
+}
+
+static int64_t edge_key(int a, int b) {
+    return a < b ? (int64_t)a << 32 | b : (int64_t)b << 32 | a;
+}
+
+static int compare_keys(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_collapses(const void* a, const void* b) {
+    double x = ((const collapse_t*)a)->cost;
+    double y = ((const collapse_t*)b)->cost;
+    return (x > y) - (x < y);
+}
+
+// Edges of the faces, sorted, each as many times as faces share it
+static int64_t* get_edge_keys(const face_t* faces, int num_faces) {
+    int64_t* keys = malloc(num_faces * 3 * sizeof(int64_t));
+    for (int i = 0; i < num_faces; i++) {
+        keys[i * 3 + 0] = edge_key(faces[i].a, faces[i].b);
+        keys[i * 3 + 1] = edge_key(faces[i].b, faces[i].c);
+        keys[i * 3 + 2] = edge_key(faces[i].c, faces[i].a);
+    }
+    qsort(keys, num_faces * 3, sizeof(int64_t), compare_keys);
+    return keys;
+}
+
+static vec3_t get_face_cross(const vec3_t* vertices, int a, int b, int c) {
+    return vec3_cross(vec3_sub(vertices[b], vertices[a]),
+                      vec3_sub(vertices[c], vertices[a]));
+}
+
+// Quadric of each vertex from the planes of its faces, plus the planes
+// holding its boundary edges
+static quadric_t* make_vertex_quadrics(const vec3_t* vertices,
+                                       const face_t* faces, int num_faces) {
+    quadric_t* quadrics = calloc(array_length((void*)vertices),
+                                 sizeof(quadric_t));
+    int64_t* keys = get_edge_keys(faces, num_faces);
+    int num_keys = num_faces * 3;
+    for (int i = 0; i < num_faces; i++) {
+        int corners[3] = {faces[i].a, faces[i].b, faces[i].c};
+        vec3_t normal = get_face_cross(vertices, corners[0], corners[1],
+                                       corners[2]);
+        float length = vec3_length(normal);
+        if (length == 0) continue;  // degenerate faces have no plane
+        normal = vec3_div(normal, length);
+        double offset = -vec3_dot(normal, vertices[corners[0]]);
+        for (int j = 0; j < 3; j++) {
+            quadric_add_plane(&quadrics[corners[j]], normal, offset, 1.0);
+            quadrics[corners[j]].weight += 1.0;
+        }
+
+        for (int j = 0; j < 3; j++) {
+            int a = corners[j];
+            int b = corners[(j + 1) % 3];
+            int64_t key = edge_key(a, b);
+            int64_t* found = bsearch(&key, keys, num_keys, sizeof(int64_t),
+                                     compare_keys);
+            bool is_boundary = (found == keys || found[-1] != key) &&
+                               (found == keys + num_keys - 1 ||
+                                found[1] != key);
+            if (!is_boundary) continue;
+            vec3_t edge_normal =
+                vec3_cross(vec3_sub(vertices[b], vertices[a]), normal);
+            float edge_length = vec3_length(edge_normal);
+            if (edge_length == 0) continue;
+            edge_normal = vec3_div(edge_normal, edge_length);
+            double edge_offset = -vec3_dot(edge_normal, vertices[a]);
+            quadric_add_plane(&quadrics[a], edge_normal, edge_offset,
+                              SIMPLIFY_BOUNDARY_WEIGHT);
+            quadric_add_plane(&quadrics[b], edge_normal, edge_offset,
+                              SIMPLIFY_BOUNDARY_WEIGHT);
+        }
+    }
+    free(keys);
+    return quadrics;
+}
+
+static int* get_face_corner(face_t* face, int vertex) {
+    if (face->a == vertex) return &face->a;
+    if (face->b == vertex) return &face->b;
+    if (face->c == vertex) return &face->c;
+    return NULL;
+}
+
+static tex2_t* get_corner_uv(face_t* face, int* corner) {
+    if (corner == &face->a) return &face->a_uv;
+    if (corner == &face->b) return &face->b_uv;
+    return &face->c_uv;
+}
+
+// Whether moving vertex from onto to turns any of its remaining faces over
+// or flattens it to nothing
+static bool does_collapse_flip(const vec3_t* vertices, face_t* faces,
+                               const int* vertex_faces, int first, int last,
+                               const bool* is_removed, int from, int to) {
+    for (int k = first; k < last; k++) {
+        face_t* face = &faces[vertex_faces[k]];
+        if (is_removed[vertex_faces[k]] || get_face_corner(face, to)) {
+            continue;
+        }
+        face_t moved = *face;
+        *get_face_corner(&moved, from) = to;
+        vec3_t before = get_face_cross(vertices, face->a, face->b, face->c);
+        vec3_t after = get_face_cross(vertices, moved.a, moved.b, moved.c);
+        if (vec3_dot(before, after) <= 0) return true;
+    }
+    return false;
+}
+
+/// @brief simplify the faces down to about target_faces by collapsing edges
+/// onto one of their vertices, cheapest quadric error first, so the faces
+/// keep indexing the same vertices. error receives the square root of the
+/// largest quadric error of a collapse, the root mean square distance in
+/// model units from the moved vertex to the planes it stood for. Returns a
+/// dynamic array of faces
+face_t* simplify_faces(const vec3_t* vertices, const face_t* faces,
+                       int num_faces, int target_faces, float* error) {
+    int num_vertices = array_length((void*)vertices);
+    quadric_t* quadrics = make_vertex_quadrics(vertices, faces, num_faces);
+    face_t* work = malloc(num_faces * sizeof(face_t));
+    memcpy(work, faces, num_faces * sizeof(face_t));
+    bool* is_removed = calloc(num_faces, sizeof(bool));
+    bool* is_locked = malloc(num_vertices * sizeof(bool));
+    int* first_vertex_face = malloc((num_vertices + 1) * sizeof(int));
+    int* vertex_faces = malloc(num_faces * 3 * sizeof(int));
+    int* fill = malloc(num_vertices * sizeof(int));
+    collapse_t* collapses = malloc(num_faces * 3 * sizeof(collapse_t));
+    double max_cost = 0;
+
+    // Each pass collapses edges cheapest first, skipping those whose
+    // vertices an earlier collapse of the pass already moved, until the
+    // target is met or nothing more can go
+    int num_left = num_faces;
+    while (num_left > target_faces) {
+        // Faces around each vertex, counted, then listed
+        memset(first_vertex_face, 0, (num_vertices + 1) * sizeof(int));
+        for (int i = 0; i < num_left; i++) {
+            first_vertex_face[work[i].a + 1]++;
+            first_vertex_face[work[i].b + 1]++;
+            first_vertex_face[work[i].c + 1]++;
+        }
+        for (int i = 0; i < num_vertices; i++) {
+            first_vertex_face[i + 1] += first_vertex_face[i];
+        }
+        memcpy(fill, first_vertex_face, num_vertices * sizeof(int));
+        for (int i = 0; i < num_left; i++) {
+            vertex_faces[fill[work[i].a]++] = i;
+            vertex_faces[fill[work[i].b]++] = i;
+            vertex_faces[fill[work[i].c]++] = i;
+        }
+
+        // Every edge once, collapsed in whichever direction costs less
+        int64_t* keys = get_edge_keys(work, num_left);
+        int num_collapses = 0;
+        for (int i = 0; i < num_left * 3; i++) {
+            if (i > 0 && keys[i] == keys[i - 1]) continue;
+            int a = keys[i] >> 32;
+            int b = keys[i] & 0xFFFFFFFF;
+            quadric_t q = quadrics[a];
+            quadric_add(&q, &quadrics[b]);
+            double cost_to_a = quadric_error(&q, vertices[a]);
+            double cost_to_b = quadric_error(&q, vertices[b]);
+            collapses[num_collapses++] =
+                cost_to_b <= cost_to_a
+                    ? (collapse_t){.from = a, .to = b, .cost = cost_to_b}
+                    : (collapse_t){.from = b, .to = a, .cost = cost_to_a};
+        }
+        free(keys);
+        qsort(collapses, num_collapses, sizeof(collapse_t),
+              compare_collapses);
+
+        memset(is_locked, 0, num_vertices * sizeof(bool));
+        int num_removed = 0;
+        for (int i = 0; i < num_collapses && num_left - num_removed >
+                                                 target_faces; i++) {
+            int from = collapses[i].from;
+            int to = collapses[i].to;
+            if (is_locked[from] || is_locked[to]) continue;
+            int first = first_vertex_face[from];
+            int last = first_vertex_face[from + 1];
+            if (does_collapse_flip(vertices, work, vertex_faces, first, last,
+                                   is_removed, from, to)) {
+                continue;
+            }
+
+            // The faces along the edge go. They also tell where the texture
+            // puts vertex to relative to vertex from, for the faces that
+            // stay and share the same texture coordinates at from
+            tex2_t from_uvs[2];
+            tex2_t to_uvs[2];
+            int num_uvs = 0;
+            for (int k = first; k < last; k++) {
+                face_t* face = &work[vertex_faces[k]];
+                if (is_removed[vertex_faces[k]]) continue;
+                int* to_corner = get_face_corner(face, to);
+                if (to_corner == NULL) continue;
+                if (num_uvs < 2) {
+                    from_uvs[num_uvs] =
+                        *get_corner_uv(face, get_face_corner(face, from));
+                    to_uvs[num_uvs++] = *get_corner_uv(face, to_corner);
+                }
+                is_removed[vertex_faces[k]] = true;
+                num_removed++;
+            }
+            for (int k = first; k < last; k++) {
+                face_t* face = &work[vertex_faces[k]];
+                if (is_removed[vertex_faces[k]]) continue;
+                int* corner = get_face_corner(face, from);
+                tex2_t* uv = get_corner_uv(face, corner);
+                for (int j = 0; j < num_uvs; j++) {
+                    if (uv->u == from_uvs[j].u && uv->v == from_uvs[j].v) {
+                        *uv = to_uvs[j];
+                        break;
+                    }
+                }
+                *corner = to;
+            }
+
+            quadric_add(&quadrics[to], &quadrics[from]);
+            is_locked[from] = true;
+            is_locked[to] = true;
+            if (collapses[i].cost > max_cost) max_cost = collapses[i].cost;
+        }
+        if (num_removed == 0) break;
+
+        int num_kept = 0;
+        for (int i = 0; i < num_left; i++) {
+            if (!is_removed[i]) work[num_kept++] = work[i];
+            is_removed[i] = false;
+        }
+        num_left = num_kept;
+    }
+
+    face_t* simplified = array_hold(NULL, num_left, sizeof(face_t));
+    memcpy(simplified, work, num_left * sizeof(face_t));
+    *error = sqrt(max_cost);
+
+    free(collapses);
+    free(fill);
+    free(vertex_faces);
+    free(first_vertex_face);
+    free(is_locked);
+    free(is_removed);
+    free(work);
+    free(quadrics);
+    return simplified;
+}
@@ -0,0 +1,14 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "triangle.h"
+#include "vector.h"
+
+// Boundary edges get planes at right angles to their faces, weighted this
+// much more than the faces themselves so open borders keep their outline
+#define SIMPLIFY_BOUNDARY_WEIGHT 10.0
+
+face_t* simplify_faces(const vec3_t* vertices, const face_t* faces,
+                       int num_faces, int target_faces, float* error);
+
+#endif
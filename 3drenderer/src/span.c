@@ -0,0 +1,714 @@
+#include "span.h"
+
+#include <SDL2/SDL.h>
+#include <math.h>
+#include <string.h>
+
+#include "display.h"
+#include "triangle.h"
+#include "visibility.h"
+
+// SSE2/AVX2 kernels are compiled with per-function target attributes, so the
+// rest of the program keeps its default flags and the CPU is checked at run
+// time before they are selected
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SPAN_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SPAN_X86 0
+#endif
+
+typedef void (*span_func_t)(const span_setup_t* setup, int y, int x_start,
+                            int x_end, int e0, int e1, int e2);
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar kernels, one pixel per iteration
+///////////////////////////////////////////////////////////////////////////////
+static void fill_span_scalar(const span_setup_t* setup, int y, int x_start,
+                             int x_end, int e0, int e1, int e2) {
+    const edge_t* edges = setup->raster.edges;
+    attribute_plane_t inv_w = setup->inv_w;
+    float inv_w_start = attribute_evaluate(inv_w, x_start, y);
+
+    for (int x = x_start; x <= x_end; x++) {
+        if (e0 >= 0 && e1 >= 0 && e2 >= 0) {
+            // Attributes are evaluated from the span start instead of being
+            // accumulated, so every kernel set computes the same values
+            float reciprocal_w = inv_w_start + (x - x_start) * inv_w.dx;
+            float depth = 1.0 - reciprocal_w;
+
+            // Only draw pixel if depth is closer than what's in Z-buffer
+            if (depth < get_zbuffer_at(x, y)) {
+                draw_pixel(x, y, setup->color);
+                update_zbuffer_at(x, y, depth);
+            }
+        }
+        e0 += edges[0].a;
+        e1 += edges[1].a;
+        e2 += edges[2].a;
+    }
+}
+
+// Trilinear filtering reads eight texels from two levels, so the kernels
+// hand it over one lane at a time
+static void filter_texels(const span_setup_t* setup, const float* us,
+                          const float* vs, int mask, int num_lanes,
+                          uint32_t* texels) {
+    for (int i = 0; i < num_lanes; i++) {
+        if (mask & (1 << i)) {
+            texels[i] = sample_trilinear(setup->texture, us[i], vs[i],
+                                         setup->lod);
+        }
+    }
+}
+
+static void texture_span_scalar(const span_setup_t* setup, int y, int x_start,
+                                int x_end, int e0, int e1, int e2) {
+    const edge_t* edges = setup->raster.edges;
+
+    attribute_plane_t inv_w = setup->inv_w;
+    attribute_plane_t u_over_w = setup->u_over_w;
+    attribute_plane_t v_over_w = setup->v_over_w;
+    float inv_w_start = attribute_evaluate(inv_w, x_start, y);
+    float u_start = attribute_evaluate(u_over_w, x_start, y);
+    float v_start = attribute_evaluate(v_over_w, x_start, y);
+
+    for (int x = x_start; x <= x_end; x++) {
+        if (e0 >= 0 && e1 >= 0 && e2 >= 0) {
+            float offset = x - x_start;
+            float reciprocal_w = inv_w_start + offset * inv_w.dx;
+            float depth = 1.0 - reciprocal_w;
+
+            // Depth test first so hidden pixels skip the texture fetch
+            if (depth < get_zbuffer_at(x, y)) {
+                // Undo the perspective divide with a single reciprocal
+                float u = 0;
+                float v = 0;
+                if (fabs(reciprocal_w) >= 0.000001) {
+                    float w = 1 / reciprocal_w;
+                    u = (u_start + offset * u_over_w.dx) * w;
+                    v = (v_start + offset * v_over_w.dx) * w;
+                }
+
+                uint32_t texel;
+                if (setup->filter == TEXTURE_FILTER_TRILINEAR) {
+                    filter_texels(setup, &u, &v, 1, 1, &texel);
+                } else {
+                    texel = sample_nearest(setup->level, u, v);
+                }
+
+                draw_pixel(x, y, modulate_color(texel, setup->color));
+                update_zbuffer_at(x, y, depth);
+            }
+        }
+        e0 += edges[0].a;
+        e1 += edges[1].a;
+        e2 += edges[2].a;
+    }
+}
+
+static int span_kernel = SPAN_KERNEL_SCALAR;
+static span_func_t fill_span = fill_span_scalar;
+static span_func_t texture_span = texture_span_scalar;
+
+#if SPAN_X86
+///////////////////////////////////////////////////////////////////////////////
+// SSE2 kernels, 4 pixels per iteration
+///////////////////////////////////////////////////////////////////////////////
+
+// floor(x / 255) for every 16-bit lane, exact for x <= 255 * 255
+TARGET_SSE2 static __m128i div255_epu16_sse2(__m128i x) {
+    __m128i one = _mm_set1_epi16(1);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one),
+                                        _mm_srli_epi16(x, 8)),
+                          8);
+}
+
+// Vector version of modulate_color(): multiply every channel by the matching
+// shading channel, with the shading alpha forced to 255 to keep texture alpha
+TARGET_SSE2 static __m128i modulate_sse2(__m128i texels, __m128i shade16) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(texels, zero), shade16);
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(texels, zero), shade16);
+    return _mm_packus_epi16(div255_epu16_sse2(lo), div255_epu16_sse2(hi));
+}
+
+// Lane-wise texel_offset of floor(u * width), floor(v * height)
+TARGET_SSE2 static __m128i texel_offsets_sse2(const mip_level_t* level,
+                                              __m128 u, __m128 v) {
+    __m128 limit = _mm_set1_ps(16777216.0);
+    __m128 x = _mm_max_ps(_mm_min_ps(_mm_mul_ps(u, _mm_set1_ps(level->width)),
+                                     limit),
+                          _mm_sub_ps(_mm_setzero_ps(), limit));
+    __m128 y = _mm_max_ps(_mm_min_ps(_mm_mul_ps(v, _mm_set1_ps(level->height)),
+                                     limit),
+                          _mm_sub_ps(_mm_setzero_ps(), limit));
+
+    // SSE2 has no floor, so truncate and step down where that rounded up
+    __m128i tex_x = _mm_cvttps_epi32(x);
+    __m128i tex_y = _mm_cvttps_epi32(y);
+    tex_x = _mm_add_epi32(
+        tex_x, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(tex_x), x)));
+    tex_y = _mm_add_epi32(
+        tex_y, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(tex_y), y)));
+
+    tex_x = _mm_and_si128(tex_x, _mm_set1_epi32(level->width - 1));
+    tex_y = _mm_and_si128(tex_y, _mm_set1_epi32(level->height - 1));
+    __m128i in_tile = _mm_set1_epi32(TEXTURE_TILE_SIZE - 1);
+    __m128i tile_row = _mm_sll_epi32(
+        _mm_srli_epi32(tex_y, TEXTURE_TILE_BITS),
+        _mm_cvtsi32_si128(level->width_shift + TEXTURE_TILE_BITS));
+    __m128i tile_column = _mm_slli_epi32(
+        _mm_srli_epi32(tex_x, TEXTURE_TILE_BITS), 2 * TEXTURE_TILE_BITS);
+    __m128i texel = _mm_add_epi32(
+        _mm_slli_epi32(_mm_and_si128(tex_y, in_tile), TEXTURE_TILE_BITS),
+        _mm_and_si128(tex_x, in_tile));
+    return _mm_add_epi32(_mm_add_epi32(tile_row, tile_column), texel);
+}
+
+// Edge function values of the 4 pixels starting where it equals e
+TARGET_SSE2 static __m128i edge_lanes_sse2(edge_t edge, int e) {
+    return _mm_setr_epi32(e, e + edge.a, e + edge.a * 2, e + edge.a * 3);
+}
+
+TARGET_SSE2 static __m128i shade16_sse2(uint32_t color) {
+    return _mm_setr_epi16(color & 0xFF, (color >> 8) & 0xFF,
+                          (color >> 16) & 0xFF, 0xFF, color & 0xFF,
+                          (color >> 8) & 0xFF, (color >> 16) & 0xFF, 0xFF);
+}
+
+TARGET_SSE2 static void fill_span_sse2(const span_setup_t* setup, int y,
+                                       int x_start, int x_end, int e0,
+                                       int e1, int e2) {
+    const edge_t* edges = setup->raster.edges;
+    int row = y * get_window_width();
+    uint32_t* color_row = get_color_buffer() + row;
+    float* depth_row = get_z_buffer() + row;
+
+    __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    __m128 four = _mm_set1_ps(4);
+    __m128i minus_one = _mm_set1_epi32(-1);
+    __m128 one = _mm_set1_ps(1.0);
+    __m128 offset = lane;  // pixel offsets from x_start
+    __m128 inv_w_start =
+        _mm_set1_ps(attribute_evaluate(setup->inv_w, x_start, y));
+    __m128 inv_w_dx = _mm_set1_ps(setup->inv_w.dx);
+    __m128i color = _mm_set1_epi32(setup->color);
+
+    __m128i ve0 = edge_lanes_sse2(edges[0], e0);
+    __m128i ve1 = edge_lanes_sse2(edges[1], e1);
+    __m128i ve2 = edge_lanes_sse2(edges[2], e2);
+    __m128i step0 = _mm_set1_epi32(edges[0].a * 4);
+    __m128i step1 = _mm_set1_epi32(edges[1].a * 4);
+    __m128i step2 = _mm_set1_epi32(edges[2].a * 4);
+
+    for (int x = x_start; x <= x_end; x += 4) {
+        // A pixel is inside when no edge function has its sign bit set
+        __m128 inside = _mm_castsi128_ps(_mm_cmpgt_epi32(
+            _mm_or_si128(_mm_or_si128(ve0, ve1), ve2), minus_one));
+
+        // The last block of the span may be shorter than 4 pixels; work on a
+        // copy so we never touch memory past x_end
+        int count = x_end - x + 1;
+        float depth_tail[4];
+        uint32_t color_tail[4];
+        float* depth_ptr = depth_row + x;
+        uint32_t* color_ptr = color_row + x;
+        if (count < 4) {
+            inside = _mm_and_ps(inside, _mm_cmplt_ps(lane, _mm_set1_ps(count)));
+            memcpy(depth_tail, depth_ptr, count * sizeof(float));
+            memcpy(color_tail, color_ptr, count * sizeof(uint32_t));
+            depth_ptr = depth_tail;
+            color_ptr = color_tail;
+        }
+
+        if (_mm_movemask_ps(inside)) {
+            __m128 reciprocal_w =
+                _mm_add_ps(inv_w_start, _mm_mul_ps(offset, inv_w_dx));
+            __m128 depth = _mm_sub_ps(one, reciprocal_w);
+            __m128 old_depth = _mm_loadu_ps(depth_ptr);
+            __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(depth, old_depth));
+
+            if (_mm_movemask_ps(pass)) {
+                __m128i pass_i = _mm_castps_si128(pass);
+                __m128i old_color = _mm_loadu_si128((__m128i*)color_ptr);
+                _mm_storeu_ps(depth_ptr,
+                              _mm_or_ps(_mm_and_ps(pass, depth),
+                                        _mm_andnot_ps(pass, old_depth)));
+                _mm_storeu_si128(
+                    (__m128i*)color_ptr,
+                    _mm_or_si128(_mm_and_si128(pass_i, color),
+                                 _mm_andnot_si128(pass_i, old_color)));
+            }
+        }
+
+        if (count < 4) {
+            memcpy(depth_row + x, depth_tail, count * sizeof(float));
+            memcpy(color_row + x, color_tail, count * sizeof(uint32_t));
+        }
+
+        ve0 = _mm_add_epi32(ve0, step0);
+        ve1 = _mm_add_epi32(ve1, step1);
+        ve2 = _mm_add_epi32(ve2, step2);
+        offset = _mm_add_ps(offset, four);
+    }
+}
+
+TARGET_SSE2 static void texture_span_sse2(const span_setup_t* setup, int y,
+                                          int x_start, int x_end, int e0,
+                                          int e1, int e2) {
+    const edge_t* edges = setup->raster.edges;
+    int row = y * get_window_width();
+    uint32_t* color_row = get_color_buffer() + row;
+    float* depth_row = get_z_buffer() + row;
+
+    __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    __m128 four = _mm_set1_ps(4);
+    __m128i minus_one = _mm_set1_epi32(-1);
+    __m128 one = _mm_set1_ps(1.0);
+    __m128 epsilon = _mm_set1_ps(0.000001);
+    __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 offset = lane;  // pixel offsets from x_start
+    __m128 inv_w_start =
+        _mm_set1_ps(attribute_evaluate(setup->inv_w, x_start, y));
+    __m128 inv_w_dx = _mm_set1_ps(setup->inv_w.dx);
+    __m128 u_start =
+        _mm_set1_ps(attribute_evaluate(setup->u_over_w, x_start, y));
+    __m128 v_start =
+        _mm_set1_ps(attribute_evaluate(setup->v_over_w, x_start, y));
+    __m128 u_dx = _mm_set1_ps(setup->u_over_w.dx);
+    __m128 v_dx = _mm_set1_ps(setup->v_over_w.dx);
+    __m128i shade16 = shade16_sse2(setup->color);
+
+    __m128i ve0 = edge_lanes_sse2(edges[0], e0);
+    __m128i ve1 = edge_lanes_sse2(edges[1], e1);
+    __m128i ve2 = edge_lanes_sse2(edges[2], e2);
+    __m128i step0 = _mm_set1_epi32(edges[0].a * 4);
+    __m128i step1 = _mm_set1_epi32(edges[1].a * 4);
+    __m128i step2 = _mm_set1_epi32(edges[2].a * 4);
+
+    for (int x = x_start; x <= x_end; x += 4) {
+        // A pixel is inside when no edge function has its sign bit set
+        __m128 inside = _mm_castsi128_ps(_mm_cmpgt_epi32(
+            _mm_or_si128(_mm_or_si128(ve0, ve1), ve2), minus_one));
+
+        int count = x_end - x + 1;
+        float depth_tail[4];
+        uint32_t color_tail[4];
+        float* depth_ptr = depth_row + x;
+        uint32_t* color_ptr = color_row + x;
+        if (count < 4) {
+            inside = _mm_and_ps(inside, _mm_cmplt_ps(lane, _mm_set1_ps(count)));
+            memcpy(depth_tail, depth_ptr, count * sizeof(float));
+            memcpy(color_tail, color_ptr, count * sizeof(uint32_t));
+            depth_ptr = depth_tail;
+            color_ptr = color_tail;
+        }
+
+        if (_mm_movemask_ps(inside)) {
+            __m128 reciprocal_w =
+                _mm_add_ps(inv_w_start, _mm_mul_ps(offset, inv_w_dx));
+            // Depth test first so hidden pixels skip the texture fetch
+            __m128 depth = _mm_sub_ps(one, reciprocal_w);
+            __m128 old_depth = _mm_loadu_ps(depth_ptr);
+            __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(depth, old_depth));
+            int pass_bits = _mm_movemask_ps(pass);
+
+            if (pass_bits) {
+                // Undo the perspective divide with one reciprocal, or fall
+                // back to (0, 0) when 1/w is too close to zero
+                __m128 valid = _mm_cmpge_ps(_mm_and_ps(reciprocal_w, abs_mask),
+                                            epsilon);
+                __m128 w = _mm_div_ps(one, reciprocal_w);
+                __m128 u_over_w =
+                    _mm_add_ps(u_start, _mm_mul_ps(offset, u_dx));
+                __m128 v_over_w =
+                    _mm_add_ps(v_start, _mm_mul_ps(offset, v_dx));
+                __m128 u = _mm_and_ps(valid, _mm_mul_ps(u_over_w, w));
+                __m128 v = _mm_and_ps(valid, _mm_mul_ps(v_over_w, w));
+
+                uint32_t fetched[4] = {0, 0, 0, 0};
+                if (setup->filter == TEXTURE_FILTER_TRILINEAR) {
+                    float us[4], vs[4];
+                    _mm_storeu_ps(us, u);
+                    _mm_storeu_ps(vs, v);
+                    filter_texels(setup, us, vs, pass_bits, 4, fetched);
+                } else {
+                    // SSE2 has no gather, so load one lane at a time
+                    int offsets[4];
+                    _mm_storeu_si128((__m128i*)offsets,
+                                     texel_offsets_sse2(setup->level, u, v));
+                    for (int i = 0; i < 4; i++) {
+                        if (pass_bits & (1 << i)) {
+                            fetched[i] = setup->level->texels[offsets[i]];
+                        }
+                    }
+                }
+                __m128i color =
+                    modulate_sse2(_mm_loadu_si128((__m128i*)fetched), shade16);
+
+                __m128i pass_i = _mm_castps_si128(pass);
+                __m128i old_color = _mm_loadu_si128((__m128i*)color_ptr);
+                _mm_storeu_ps(depth_ptr,
+                              _mm_or_ps(_mm_and_ps(pass, depth),
+                                        _mm_andnot_ps(pass, old_depth)));
+                _mm_storeu_si128(
+                    (__m128i*)color_ptr,
+                    _mm_or_si128(_mm_and_si128(pass_i, color),
+                                 _mm_andnot_si128(pass_i, old_color)));
+            }
+        }
+
+        if (count < 4) {
+            memcpy(depth_row + x, depth_tail, count * sizeof(float));
+            memcpy(color_row + x, color_tail, count * sizeof(uint32_t));
+        }
+
+        ve0 = _mm_add_epi32(ve0, step0);
+        ve1 = _mm_add_epi32(ve1, step1);
+        ve2 = _mm_add_epi32(ve2, step2);
+        offset = _mm_add_ps(offset, four);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2 kernels, 8 pixels per iteration
+///////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static __m256i div255_epu16_avx2(__m256i x) {
+    __m256i one = _mm256_set1_epi16(1);
+    return _mm256_srli_epi16(
+        _mm256_add_epi16(_mm256_add_epi16(x, one), _mm256_srli_epi16(x, 8)), 8);
+}
+
+TARGET_AVX2 static __m256i modulate_avx2(__m256i texels, __m256i shade16) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo =
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(texels, zero), shade16);
+    __m256i hi =
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(texels, zero), shade16);
+    return _mm256_packus_epi16(div255_epu16_avx2(lo), div255_epu16_avx2(hi));
+}
+
+TARGET_AVX2 static __m256i texel_offsets_avx2(const mip_level_t* level,
+                                              __m256 u, __m256 v) {
+    __m256 limit = _mm256_set1_ps(16777216.0);
+    __m256 min_limit = _mm256_set1_ps(-16777216.0);
+    __m256 x = _mm256_max_ps(
+        _mm256_min_ps(_mm256_mul_ps(u, _mm256_set1_ps(level->width)), limit),
+        min_limit);
+    __m256 y = _mm256_max_ps(
+        _mm256_min_ps(_mm256_mul_ps(v, _mm256_set1_ps(level->height)), limit),
+        min_limit);
+    __m256i tex_x = _mm256_and_si256(_mm256_cvttps_epi32(_mm256_floor_ps(x)),
+                                     _mm256_set1_epi32(level->width - 1));
+    __m256i tex_y = _mm256_and_si256(_mm256_cvttps_epi32(_mm256_floor_ps(y)),
+                                     _mm256_set1_epi32(level->height - 1));
+
+    __m256i in_tile = _mm256_set1_epi32(TEXTURE_TILE_SIZE - 1);
+    __m256i tile_row = _mm256_sll_epi32(
+        _mm256_srli_epi32(tex_y, TEXTURE_TILE_BITS),
+        _mm_cvtsi32_si128(level->width_shift + TEXTURE_TILE_BITS));
+    __m256i tile_column = _mm256_slli_epi32(
+        _mm256_srli_epi32(tex_x, TEXTURE_TILE_BITS), 2 * TEXTURE_TILE_BITS);
+    __m256i texel = _mm256_add_epi32(
+        _mm256_slli_epi32(_mm256_and_si256(tex_y, in_tile), TEXTURE_TILE_BITS),
+        _mm256_and_si256(tex_x, in_tile));
+    return _mm256_add_epi32(_mm256_add_epi32(tile_row, tile_column), texel);
+}
+
+TARGET_AVX2 static void fill_span_avx2(const span_setup_t* setup, int y,
+                                       int x_start, int x_end, int e0,
+                                       int e1, int e2) {
+    const edge_t* edges = setup->raster.edges;
+    int row = y * get_window_width();
+    uint32_t* color_row = get_color_buffer() + row;
+    float* depth_row = get_z_buffer() + row;
+
+    __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 eight = _mm256_set1_ps(8);
+    __m256i minus_one = _mm256_set1_epi32(-1);
+    __m256 one = _mm256_set1_ps(1.0);
+    __m256 offset = lane;
+    __m256 inv_w_start =
+        _mm256_set1_ps(attribute_evaluate(setup->inv_w, x_start, y));
+    __m256 inv_w_dx = _mm256_set1_ps(setup->inv_w.dx);
+    __m256 color = _mm256_castsi256_ps(_mm256_set1_epi32(setup->color));
+
+    __m256i lane_i = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i ve0 = _mm256_add_epi32(
+        _mm256_set1_epi32(e0),
+        _mm256_mullo_epi32(_mm256_set1_epi32(edges[0].a), lane_i));
+    __m256i ve1 = _mm256_add_epi32(
+        _mm256_set1_epi32(e1),
+        _mm256_mullo_epi32(_mm256_set1_epi32(edges[1].a), lane_i));
+    __m256i ve2 = _mm256_add_epi32(
+        _mm256_set1_epi32(e2),
+        _mm256_mullo_epi32(_mm256_set1_epi32(edges[2].a), lane_i));
+    __m256i step0 = _mm256_set1_epi32(edges[0].a * 8);
+    __m256i step1 = _mm256_set1_epi32(edges[1].a * 8);
+    __m256i step2 = _mm256_set1_epi32(edges[2].a * 8);
+
+    for (int x = x_start; x <= x_end; x += 8) {
+        __m256 inside = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+            _mm256_or_si256(_mm256_or_si256(ve0, ve1), ve2), minus_one));
+
+        int count = x_end - x + 1;
+        float depth_tail[8];
+        uint32_t color_tail[8];
+        float* depth_ptr = depth_row + x;
+        uint32_t* color_ptr = color_row + x;
+        if (count < 8) {
+            inside = _mm256_and_ps(
+                inside, _mm256_cmp_ps(lane, _mm256_set1_ps(count), _CMP_LT_OQ));
+            memcpy(depth_tail, depth_ptr, count * sizeof(float));
+            memcpy(color_tail, color_ptr, count * sizeof(uint32_t));
+            depth_ptr = depth_tail;
+            color_ptr = color_tail;
+        }
+
+        if (_mm256_movemask_ps(inside)) {
+            __m256 reciprocal_w =
+                _mm256_add_ps(inv_w_start, _mm256_mul_ps(offset, inv_w_dx));
+            __m256 depth = _mm256_sub_ps(one, reciprocal_w);
+            __m256 old_depth = _mm256_loadu_ps(depth_ptr);
+            __m256 pass = _mm256_and_ps(
+                inside, _mm256_cmp_ps(depth, old_depth, _CMP_LT_OQ));
+
+            if (_mm256_movemask_ps(pass)) {
+                __m256 old_color = _mm256_loadu_ps((float*)color_ptr);
+                _mm256_storeu_ps(depth_ptr,
+                                 _mm256_blendv_ps(old_depth, depth, pass));
+                _mm256_storeu_ps((float*)color_ptr,
+                                 _mm256_blendv_ps(old_color, color, pass));
+            }
+        }
+
+        if (count < 8) {
+            memcpy(depth_row + x, depth_tail, count * sizeof(float));
+            memcpy(color_row + x, color_tail, count * sizeof(uint32_t));
+        }
+
+        ve0 = _mm256_add_epi32(ve0, step0);
+        ve1 = _mm256_add_epi32(ve1, step1);
+        ve2 = _mm256_add_epi32(ve2, step2);
+        offset = _mm256_add_ps(offset, eight);
+    }
+}
+
+TARGET_AVX2 static void texture_span_avx2(const span_setup_t* setup, int y,
+                                          int x_start, int x_end, int e0,
+                                          int e1, int e2) {
+    const edge_t* edges = setup->raster.edges;
+    int row = y * get_window_width();
+    uint32_t* color_row = get_color_buffer() + row;
+    float* depth_row = get_z_buffer() + row;
+
+    __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 eight = _mm256_set1_ps(8);
+    __m256i minus_one = _mm256_set1_epi32(-1);
+    __m256 one = _mm256_set1_ps(1.0);
+    __m256 epsilon = _mm256_set1_ps(0.000001);
+    __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 offset = lane;
+    __m256 inv_w_start =
+        _mm256_set1_ps(attribute_evaluate(setup->inv_w, x_start, y));
+    __m256 inv_w_dx = _mm256_set1_ps(setup->inv_w.dx);
+    __m256 u_start =
+        _mm256_set1_ps(attribute_evaluate(setup->u_over_w, x_start, y));
+    __m256 v_start =
+        _mm256_set1_ps(attribute_evaluate(setup->v_over_w, x_start, y));
+    __m256 u_dx = _mm256_set1_ps(setup->u_over_w.dx);
+    __m256 v_dx = _mm256_set1_ps(setup->v_over_w.dx);
+    uint32_t c = setup->color;
+    __m256i shade16 = _mm256_setr_epi16(
+        c & 0xFF, (c >> 8) & 0xFF, (c >> 16) & 0xFF, 0xFF, c & 0xFF,
+        (c >> 8) & 0xFF, (c >> 16) & 0xFF, 0xFF, c & 0xFF, (c >> 8) & 0xFF,
+        (c >> 16) & 0xFF, 0xFF, c & 0xFF, (c >> 8) & 0xFF, (c >> 16) & 0xFF,
+        0xFF);
+
+    __m256i lane_i = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i ve0 = _mm256_add_epi32(
+        _mm256_set1_epi32(e0),
+        _mm256_mullo_epi32(_mm256_set1_epi32(edges[0].a), lane_i));
+    __m256i ve1 = _mm256_add_epi32(
+        _mm256_set1_epi32(e1),
+        _mm256_mullo_epi32(_mm256_set1_epi32(edges[1].a), lane_i));
+    __m256i ve2 = _mm256_add_epi32(
+        _mm256_set1_epi32(e2),
+        _mm256_mullo_epi32(_mm256_set1_epi32(edges[2].a), lane_i));
+    __m256i step0 = _mm256_set1_epi32(edges[0].a * 8);
+    __m256i step1 = _mm256_set1_epi32(edges[1].a * 8);
+    __m256i step2 = _mm256_set1_epi32(edges[2].a * 8);
+
+    for (int x = x_start; x <= x_end; x += 8) {
+        __m256 inside = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+            _mm256_or_si256(_mm256_or_si256(ve0, ve1), ve2), minus_one));
+
+        int count = x_end - x + 1;
+        float depth_tail[8];
+        uint32_t color_tail[8];
+        float* depth_ptr = depth_row + x;
+        uint32_t* color_ptr = color_row + x;
+        if (count < 8) {
+            inside = _mm256_and_ps(
+                inside, _mm256_cmp_ps(lane, _mm256_set1_ps(count), _CMP_LT_OQ));
+            memcpy(depth_tail, depth_ptr, count * sizeof(float));
+            memcpy(color_tail, color_ptr, count * sizeof(uint32_t));
+            depth_ptr = depth_tail;
+            color_ptr = color_tail;
+        }
+
+        if (_mm256_movemask_ps(inside)) {
+            __m256 reciprocal_w =
+                _mm256_add_ps(inv_w_start, _mm256_mul_ps(offset, inv_w_dx));
+            __m256 depth = _mm256_sub_ps(one, reciprocal_w);
+            __m256 old_depth = _mm256_loadu_ps(depth_ptr);
+            __m256 pass = _mm256_and_ps(
+                inside, _mm256_cmp_ps(depth, old_depth, _CMP_LT_OQ));
+            int pass_bits = _mm256_movemask_ps(pass);
+
+            if (pass_bits) {
+                __m256 valid = _mm256_cmp_ps(
+                    _mm256_and_ps(reciprocal_w, abs_mask), epsilon, _CMP_GE_OQ);
+                __m256 w = _mm256_div_ps(one, reciprocal_w);
+                __m256 u_over_w =
+                    _mm256_add_ps(u_start, _mm256_mul_ps(offset, u_dx));
+                __m256 v_over_w =
+                    _mm256_add_ps(v_start, _mm256_mul_ps(offset, v_dx));
+                __m256 u = _mm256_and_ps(valid, _mm256_mul_ps(u_over_w, w));
+                __m256 v = _mm256_and_ps(valid, _mm256_mul_ps(v_over_w, w));
+
+                __m256i texels;
+                if (setup->filter == TEXTURE_FILTER_TRILINEAR) {
+                    float us[8], vs[8];
+                    uint32_t fetched[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+                    _mm256_storeu_ps(us, u);
+                    _mm256_storeu_ps(vs, v);
+                    filter_texels(setup, us, vs, pass_bits, 8, fetched);
+                    texels = _mm256_loadu_si256((__m256i*)fetched);
+                } else {
+                    __m256i offsets = texel_offsets_avx2(setup->level, u, v);
+                    texels = _mm256_mask_i32gather_epi32(
+                        _mm256_setzero_si256(),
+                        (const int*)setup->level->texels, offsets,
+                        _mm256_castps_si256(pass), 4);
+                }
+                __m256 color =
+                    _mm256_castsi256_ps(modulate_avx2(texels, shade16));
+
+                __m256 old_color = _mm256_loadu_ps((float*)color_ptr);
+                _mm256_storeu_ps(depth_ptr,
+                                 _mm256_blendv_ps(old_depth, depth, pass));
+                _mm256_storeu_ps((float*)color_ptr,
+                                 _mm256_blendv_ps(old_color, color, pass));
+            }
+        }
+
+        if (count < 8) {
+            memcpy(depth_row + x, depth_tail, count * sizeof(float));
+            memcpy(color_row + x, color_tail, count * sizeof(uint32_t));
+        }
+
+        ve0 = _mm256_add_epi32(ve0, step0);
+        ve1 = _mm256_add_epi32(ve1, step1);
+        ve2 = _mm256_add_epi32(ve2, step2);
+        offset = _mm256_add_ps(offset, eight);
+    }
+}
+#endif
+
+/// @brief pick the widest span kernels the CPU supports
+void init_span_kernels(void) {
+    if (!set_span_kernel(SPAN_KERNEL_AVX2) &&
+        !set_span_kernel(SPAN_KERNEL_SSE2)) {
+        set_span_kernel(SPAN_KERNEL_SCALAR);
+    }
+}
+
+/// @brief switch to the given kernels, returns false if the CPU (or the
+/// build) can't run them and keeps the current ones
+bool set_span_kernel(int kernel) {
+    switch (kernel) {
+#if SPAN_X86
+        case SPAN_KERNEL_AVX2:
+            if (!SDL_HasAVX2()) return false;
+            fill_span = fill_span_avx2;
+            texture_span = texture_span_avx2;
+            break;
+        case SPAN_KERNEL_SSE2:
+            if (!SDL_HasSSE2()) return false;
+            fill_span = fill_span_sse2;
+            texture_span = texture_span_sse2;
+            break;
+#endif
+        case SPAN_KERNEL_SCALAR:
+            fill_span = fill_span_scalar;
+            texture_span = texture_span_scalar;
+            break;
+        default:
+            return false;
+    }
+    span_kernel = kernel;
+    return true;
+}
+
+int get_span_kernel(void) { return span_kernel; }
+
+const char* get_span_kernel_name(void) {
+    switch (span_kernel) {
+        case SPAN_KERNEL_AVX2:
+            return "AVX2";
+        case SPAN_KERNEL_SSE2:
+            return "SSE2";
+        default:
+            return "scalar";
+    }
+}
+
+void draw_fill_span(const span_setup_t* setup, int y, int x_start, int x_end,
+                    int e0, int e1, int e2) {
+    fill_span(setup, y, x_start, x_end, e0, e1, e2);
+}
+
+void draw_texture_span(const span_setup_t* setup, int y, int x_start,
+                       int x_end, int e0, int e1, int e2) {
+    texture_span(setup, y, x_start, x_end, e0, e1, e2);
+}
+
+// Depth-only pass of the visibility buffer. It touches no texture, so the
+// scalar loop is kept for every kernel set
+void draw_visibility_span(const span_setup_t* setup, int y, int x_start,
+                          int x_end, int e0, int e1, int e2) {
+    const edge_t* edges = setup->raster.edges;
+    int row = y * get_window_width();
+    float* depth_row = get_z_buffer() + row;
+    visibility_sample_t* sample_row = get_visibility_buffer() + row;
+
+    attribute_plane_t inv_w = setup->inv_w;
+    attribute_plane_t u_over_w = setup->u_over_w;
+    attribute_plane_t v_over_w = setup->v_over_w;
+    float inv_w_start = attribute_evaluate(inv_w, x_start, y);
+    float u_start = attribute_evaluate(u_over_w, x_start, y);
+    float v_start = attribute_evaluate(v_over_w, x_start, y);
+
+    for (int x = x_start; x <= x_end; x++) {
+        if (e0 >= 0 && e1 >= 0 && e2 >= 0) {
+            float offset = x - x_start;
+            float reciprocal_w = inv_w_start + offset * inv_w.dx;
+            float depth = 1.0 - reciprocal_w;
+            if (depth < depth_row[x]) {
+                depth_row[x] = depth;
+                sample_row[x].triangle_index = setup->triangle_index;
+                sample_row[x].inv_w = reciprocal_w;
+                sample_row[x].u_over_w = u_start + offset * u_over_w.dx;
+                sample_row[x].v_over_w = v_start + offset * v_over_w.dx;
+                sample_row[x].lod = setup->lod;
+            }
+        }
+        e0 += edges[0].a;
+        e1 += edges[1].a;
+        e2 += edges[2].a;
+    }
+}
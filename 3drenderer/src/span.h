@@ -0,0 +1,43 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <stdint.h>
+
+#include "rasterizer.h"
+#include "texture.h"
+
+enum span_kernel { SPAN_KERNEL_SCALAR, SPAN_KERNEL_SSE2, SPAN_KERNEL_AVX2 };
+
+// Everything a span kernel needs about the triangle being drawn. The
+// attributes are set up once per triangle as screen-space planes, so a kernel
+// steps them with one add per pixel and a single reciprocal undoes the
+// perspective divide
+typedef struct {
+    raster_triangle_t raster;
+    attribute_plane_t inv_w;     // 1/w, also gives the depth as 1 - 1/w
+    attribute_plane_t u_over_w;  // u/w, textured paths only
+    attribute_plane_t v_over_w;  // v/w, textured paths only
+    float min_depth;             // nearest depth of the whole triangle
+    uint32_t color;              // flat color, or shading color if textured
+    const texture_t* texture;
+    float lod;   // texture level of detail of the whole triangle
+    int filter;  // texture filter the triangle is drawn with
+    const mip_level_t* level;  // mip level point sampling reads from
+    int triangle_index;  // written to the visibility buffer
+} span_setup_t;
+
+void init_span_kernels(void);
+bool set_span_kernel(int kernel);
+int get_span_kernel(void);
+const char* get_span_kernel_name(void);
+
+// Draw pixels x_start..x_end (inclusive) of row y, where e0/e1/e2 are the edge
+// function values at (x_start, y)
+void draw_fill_span(const span_setup_t* setup, int y, int x_start, int x_end,
+                    int e0, int e1, int e2);
+void draw_texture_span(const span_setup_t* setup, int y, int x_start,
+                       int x_end, int e0, int e1, int e2);
+void draw_visibility_span(const span_setup_t* setup, int y, int x_start,
+                          int x_end, int e0, int e1, int e2);
+
+#endif
@@ -1,17 +0,0 @@
-#include "swap.h"
-
-void int_swap(int* a, int* b) {
-    int tmp = *a;
-    *a = *b;
-    *b = tmp;
-}
-void float_swap(float* a, float* b) {
-    float tmp = *a;
-    *a = *b;
-    *b = tmp;
-}
-void triangle_swap(triangle_t* a, triangle_t* b) {
-    triangle_t tmp = *a;
-    *a = *b;
-    *b = tmp;
-}
\ No newline at end of file
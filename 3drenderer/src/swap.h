@@ -1,10 +0,0 @@
-#ifndef SWAP_H
-#define SWAP_H
-
-#include "triangle.h"
-
-void int_swap(int* a, int* b);
-void float_swap(float* a, float* b);
-void triangle_swap(triangle_t* a, triangle_t* b);
-
-#endif
\ No newline at end of file
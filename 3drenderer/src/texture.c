@@ -1,6 +1,308 @@
 #include "texture.h"
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int texture_filter = TEXTURE_FILTER_TRILINEAR;
+
 tex2_t tex2_clone(tex2_t* t) {
     tex2_t result = {t->u, t->v};
     return result;
 }
+
+// Average of four packed colors, channel by channel
+static uint32_t average_texels(uint32_t a, uint32_t b, uint32_t c,
+                               uint32_t d) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) +
+                       ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+        result |= ((sum + 2) / 4) << shift;
+    }
+    return result;
+}
+
+// Channel-wise (a * (256 - weight) + b * weight) / 256, blending red with
+// blue and green with alpha two channels at a time
+static uint32_t lerp_texels(uint32_t a, uint32_t b, int weight) {
+    uint32_t a_rb = a & 0x00FF00FF;
+    uint32_t a_ga = (a >> 8) & 0x00FF00FF;
+    uint32_t b_rb = b & 0x00FF00FF;
+    uint32_t b_ga = (b >> 8) & 0x00FF00FF;
+    uint32_t rb = ((a_rb * (256 - weight) + b_rb * weight) >> 8) & 0x00FF00FF;
+    uint32_t ga = (a_ga * (256 - weight) + b_ga * weight) & 0xFF00FF00;
+    return rb | ga;
+}
+
+static int wrap(int coord, int size) {
+    coord %= size;
+    return coord < 0 ? coord + size : coord;
+}
+
+static int next_power_of_two(int n) {
+    int result = TEXTURE_TILE_SIZE;
+    while (result < n) result *= 2;
+    return result;
+}
+
+// The color buffer is SDL_PIXELFORMAT_RGBA32, which stores red, green, blue
+// and alpha bytes in that order in memory whatever the host byte order
+static uint32_t pack_texel(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    uint8_t bytes[4] = {r, g, b, a};
+    uint32_t texel;
+    memcpy(&texel, bytes, sizeof(texel));
+    return texel;
+}
+
+// Sample of the given channel of pixel i scaled to 0..255. upng keeps
+// sub-byte samples as one bit stream, and 16-bit ones big endian, so their
+// high byte comes first
+static uint8_t read_png_sample(const unsigned char* buffer, int bitdepth,
+                               int components, int i, int channel) {
+    long bit = ((long)i * components + channel) * bitdepth;
+    if (bitdepth >= 8) {
+        return buffer[bit / 8];
+    }
+    int max_value = (1 << bitdepth) - 1;
+    int shift = 8 - bitdepth - bit % 8;
+    return ((buffer[bit / 8] >> shift) & max_value) * 255 / max_value;
+}
+
+// Convert any upng format to packed texels, row by row
+static uint32_t* convert_png_texels(upng_t* png_image) {
+    int width = upng_get_width(png_image);
+    int height = upng_get_height(png_image);
+    int bitdepth = upng_get_bitdepth(png_image);
+    int components = upng_get_components(png_image);
+    const unsigned char* buffer = upng_get_buffer(png_image);
+
+    uint32_t* texels = (uint32_t*)malloc(width * height * sizeof(uint32_t));
+    for (int i = 0; i < width * height; i++) {
+        uint8_t r, g, b, a = 0xFF;
+        if (components >= 3) {
+            r = read_png_sample(buffer, bitdepth, components, i, 0);
+            g = read_png_sample(buffer, bitdepth, components, i, 1);
+            b = read_png_sample(buffer, bitdepth, components, i, 2);
+        } else {
+            r = g = b = read_png_sample(buffer, bitdepth, components, i, 0);
+        }
+        if (components == 2 || components == 4) {
+            a = read_png_sample(buffer, bitdepth, components, i,
+                                components - 1);
+        }
+        texels[i] = pack_texel(r, g, b, a);
+    }
+    return texels;
+}
+
+// Bilinear resample of a repeating image to a new size, both row by row
+static uint32_t* resample_texels(const uint32_t* src, int src_width,
+                                 int src_height, int width, int height) {
+    uint32_t* texels = (uint32_t*)malloc(width * height * sizeof(uint32_t));
+    for (int y = 0; y < height; y++) {
+        float src_y = (y + 0.5) * src_height / height - 0.5;
+        int y0 = floor(src_y);
+        int weight_y = (src_y - y0) * 256;
+        const uint32_t* row0 = src + wrap(y0, src_height) * src_width;
+        const uint32_t* row1 = src + wrap(y0 + 1, src_height) * src_width;
+        for (int x = 0; x < width; x++) {
+            float src_x = (x + 0.5) * src_width / width - 0.5;
+            int x0 = floor(src_x);
+            int weight_x = (src_x - x0) * 256;
+            int x1 = wrap(x0 + 1, src_width);
+            x0 = wrap(x0, src_width);
+            uint32_t top = lerp_texels(row0[x0], row0[x1], weight_x);
+            uint32_t bottom = lerp_texels(row1[x0], row1[x1], weight_x);
+            texels[y * width + x] = lerp_texels(top, bottom, weight_y);
+        }
+    }
+    return texels;
+}
+
+// Reorder a level from rows into tiles
+static void tile_level(mip_level_t* level) {
+    uint32_t* tiled =
+        (uint32_t*)malloc(level->width * level->height * sizeof(uint32_t));
+    for (int y = 0; y < level->height; y++) {
+        for (int x = 0; x < level->width; x++) {
+            tiled[texel_offset(level, x, y)] =
+                level->texels[y * level->width + x];
+        }
+    }
+    free(level->texels);
+    level->texels = tiled;
+}
+
+/// @brief convert a decoded PNG into a texture: the pixels are packed in the
+/// color buffer's channel order, resampled to power-of-two sizes, box-filtered
+/// down into mip levels and finally stored in tiles. Returns NULL for images
+/// upng couldn't decode
+texture_t* texture_from_png(upng_t* png_image) {
+    if (upng_get_format(png_image) == UPNG_BADFORMAT ||
+        upng_get_buffer(png_image) == NULL) {
+        return NULL;
+    }
+
+    int src_width = upng_get_width(png_image);
+    int src_height = upng_get_height(png_image);
+    uint32_t* texels = convert_png_texels(png_image);
+
+    texture_t* texture = (texture_t*)calloc(1, sizeof(texture_t));
+    mip_level_t* base = &texture->levels[0];
+    base->width = next_power_of_two(src_width);
+    base->height = next_power_of_two(src_height);
+    if (base->width != src_width || base->height != src_height) {
+        base->texels = resample_texels(texels, src_width, src_height,
+                                       base->width, base->height);
+        free(texels);
+    } else {
+        base->texels = texels;
+    }
+    texture->num_levels = 1;
+
+    // Every level keeps at least one whole tile
+    while (texture->num_levels < MAX_MIP_LEVELS) {
+        mip_level_t* src = &texture->levels[texture->num_levels - 1];
+        if (src->width == TEXTURE_TILE_SIZE ||
+            src->height == TEXTURE_TILE_SIZE) {
+            break;
+        }
+
+        mip_level_t* dst = &texture->levels[texture->num_levels];
+        dst->width = src->width / 2;
+        dst->height = src->height / 2;
+        dst->texels =
+            (uint32_t*)malloc(dst->width * dst->height * sizeof(uint32_t));
+
+        for (int y = 0; y < dst->height; y++) {
+            const uint32_t* row0 = src->texels + y * 2 * src->width;
+            const uint32_t* row1 = row0 + src->width;
+            for (int x = 0; x < dst->width; x++) {
+                dst->texels[y * dst->width + x] =
+                    average_texels(row0[x * 2], row0[x * 2 + 1], row1[x * 2],
+                                   row1[x * 2 + 1]);
+            }
+        }
+        texture->num_levels++;
+    }
+
+    for (int i = 0; i < texture->num_levels; i++) {
+        mip_level_t* level = &texture->levels[i];
+        while ((1 << level->width_shift) < level->width) {
+            level->width_shift++;
+        }
+        tile_level(level);
+    }
+    return texture;
+}
+
+void free_texture(texture_t* texture) {
+    if (texture == NULL) return;
+    for (int i = 0; i < texture->num_levels; i++) {
+        free(texture->levels[i].texels);
+    }
+    free(texture);
+}
+
+void set_texture_filter(int filter) { texture_filter = filter; }
+int get_texture_filter(void) { return texture_filter; }
+
+const char* get_texture_filter_name(void) {
+    switch (texture_filter) {
+        case TEXTURE_FILTER_NEAREST:
+            return "nearest";
+        case TEXTURE_FILTER_NEAREST_MIPMAP:
+            return "nearest mipmap";
+        default:
+            return "trilinear";
+    }
+}
+
+/// @brief level of detail of a triangle, log2 of how many texels of level 0
+/// fall along one pixel; screen_area is twice the triangle area in pixels
+float get_texture_lod(const texture_t* texture, const tex2_t uvs[3],
+                      float screen_area) {
+    const mip_level_t* base = &texture->levels[0];
+    float du1 = (uvs[1].u - uvs[0].u) * base->width;
+    float dv1 = (uvs[1].v - uvs[0].v) * base->height;
+    float du2 = (uvs[2].u - uvs[0].u) * base->width;
+    float dv2 = (uvs[2].v - uvs[0].v) * base->height;
+    float texel_area = fabs(du1 * dv2 - dv1 * du2);
+
+    if (texel_area <= 0 || screen_area <= 0) {
+        return 0;
+    }
+    // Areas scale with the square of the footprint, hence half the log
+    return 0.5 * log2(texel_area / screen_area);
+}
+
+/// @brief level that point sampling should read for the current filter
+const mip_level_t* select_mip_level(const texture_t* texture, float lod) {
+    if (texture_filter == TEXTURE_FILTER_NEAREST || lod <= 0) {
+        return &texture->levels[0];
+    }
+    int level = floor(lod + 0.5);
+    if (level >= texture->num_levels) level = texture->num_levels - 1;
+    return &texture->levels[level];
+}
+
+// Keeps huge repeat counts away from the int conversion; any power of two
+// size divides the limit, so the wrapped texel is unchanged
+static float clamp_texel_coord(float coord) {
+    return fmax(fmin(coord, 16777216.0), -16777216.0);
+}
+
+uint32_t sample_nearest(const mip_level_t* level, float u, float v) {
+    int tex_x = floor(clamp_texel_coord(u * level->width));
+    int tex_y = floor(clamp_texel_coord(v * level->height));
+    return level->texels[texel_offset(level, tex_x, tex_y)];
+}
+
+static uint32_t sample_bilinear(const mip_level_t* level, float u, float v) {
+    // Texel centers sit at half-integer coordinates
+    float x = clamp_texel_coord(u * level->width - 0.5);
+    float y = clamp_texel_coord(v * level->height - 0.5);
+
+    float x_floor = floor(x);
+    float y_floor = floor(y);
+    int weight_x = (x - x_floor) * 256;
+    int weight_y = (y - y_floor) * 256;
+
+    int x0 = x_floor;
+    int y0 = y_floor;
+
+    const uint32_t* texels = level->texels;
+    uint32_t top = lerp_texels(texels[texel_offset(level, x0, y0)],
+                               texels[texel_offset(level, x0 + 1, y0)],
+                               weight_x);
+    uint32_t bottom = lerp_texels(texels[texel_offset(level, x0, y0 + 1)],
+                                  texels[texel_offset(level, x0 + 1, y0 + 1)],
+                                  weight_x);
+    return lerp_texels(top, bottom, weight_y);
+}
+
+uint32_t sample_trilinear(const texture_t* texture, float u, float v,
+                          float lod) {
+    // Magnified, or past the last level: a single bilinear lookup
+    if (lod <= 0) {
+        return sample_bilinear(&texture->levels[0], u, v);
+    }
+    int level = floor(lod);
+    if (level >= texture->num_levels - 1) {
+        return sample_bilinear(&texture->levels[texture->num_levels - 1], u,
+                               v);
+    }
+
+    uint32_t fine = sample_bilinear(&texture->levels[level], u, v);
+    uint32_t coarse = sample_bilinear(&texture->levels[level + 1], u, v);
+    return lerp_texels(fine, coarse, (lod - level) * 256);
+}
+
+/// @brief sample with the current texture filter
+uint32_t sample_texture(const texture_t* texture, float u, float v, float lod) {
+    if (texture_filter == TEXTURE_FILTER_TRILINEAR) {
+        return sample_trilinear(texture, u, v, lod);
+    }
+    return sample_nearest(select_mip_level(texture, lod), u, v);
+}
@@ -1,13 +1,70 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
-#include "texture.h"
+#include <stdint.h>
+
+#include "upng.h"
+
+#define MAX_MIP_LEVELS 16
+
+enum texture_filter {
+    TEXTURE_FILTER_NEAREST,         // full resolution, point sampled
+    TEXTURE_FILTER_NEAREST_MIPMAP,  // closest mip level, point sampled
+    TEXTURE_FILTER_TRILINEAR        // bilinear in the two closest mip levels
+};
 
 typedef struct {
     float u;
     float v;
 } tex2_t;
 
+// Texels are stored in square tiles of TEXTURE_TILE_SIZE x TEXTURE_TILE_SIZE,
+// so neighbors in both directions usually share a cache line
+#define TEXTURE_TILE_BITS 2
+#define TEXTURE_TILE_SIZE (1 << TEXTURE_TILE_BITS)
+
+typedef struct {
+    int width;         // power of two, at least TEXTURE_TILE_SIZE
+    int height;        // power of two, at least TEXTURE_TILE_SIZE
+    int width_shift;   // log2(width)
+    uint32_t* texels;  // packed in the color buffer's channel order, tiled
+} mip_level_t;
+
+// Renderer-owned texture converted once at load time: power-of-two levels so
+// coordinates wrap with a mask, each level half the size of the previous one
+typedef struct {
+    mip_level_t levels[MAX_MIP_LEVELS];
+    int num_levels;
+} texture_t;
+
 tex2_t tex2_clone(tex2_t* t);
 
-#endif
\ No newline at end of file
+texture_t* texture_from_png(upng_t* png_image);
+void free_texture(texture_t* texture);
+
+void set_texture_filter(int filter);
+int get_texture_filter(void);
+const char* get_texture_filter_name(void);
+
+// Offset of texel (x, y) in a level: the coordinates wrap around with a mask
+// and the tiles are laid out row by row
+static inline int texel_offset(const mip_level_t* level, int x, int y) {
+    x &= level->width - 1;
+    y &= level->height - 1;
+    int tile_row = y >> TEXTURE_TILE_BITS;
+    int tile_column = x >> TEXTURE_TILE_BITS;
+    return (tile_row << (level->width_shift + TEXTURE_TILE_BITS)) +
+           (tile_column << (2 * TEXTURE_TILE_BITS)) +
+           ((y & (TEXTURE_TILE_SIZE - 1)) << TEXTURE_TILE_BITS) +
+           (x & (TEXTURE_TILE_SIZE - 1));
+}
+
+float get_texture_lod(const texture_t* texture, const tex2_t uvs[3],
+                      float screen_area);
+const mip_level_t* select_mip_level(const texture_t* texture, float lod);
+uint32_t sample_nearest(const mip_level_t* level, float u, float v);
+uint32_t sample_trilinear(const texture_t* texture, float u, float v,
+                          float lod);
+uint32_t sample_texture(const texture_t* texture, float u, float v, float lod);
+
+#endif
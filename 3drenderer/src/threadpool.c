@@ -0,0 +1,392 @@
+#include "threadpool.h"
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MAX_NUM_WORKERS 64
+
+// Jobs a queue holds at most; a job added to a full queue runs right away
+#define JOB_QUEUE_SIZE 1024
+
+// Tasks task_index in [first, end) run by one job, the upper part of the
+// range handed to other threads while it is more than batch_size
+typedef struct {
+    thread_pool_task_t task;
+    void* context;
+    int first;
+    int end;
+    int batch_size;
+    job_counter_t* counter;
+} job_t;
+
+// A job held by a counter until it reaches zero
+typedef struct pending_job {
+    job_t job;
+    struct pending_job* next;
+} pending_job_t;
+
+// Each thread adds and takes jobs at the bottom of its own queue, newest
+// first while their data is still in its cache. Threads out of work steal
+// from the top of the others' queues, where the oldest and largest ranges
+// are
+typedef struct {
+    job_t jobs[JOB_QUEUE_SIZE];
+    int top;            // wraps around JOB_QUEUE_SIZE
+    int bottom;
+    SDL_SpinLock lock;
+} job_queue_t;
+
+static SDL_Thread* workers[MAX_NUM_WORKERS];
+static int num_workers = 0;
+
+// Queue 0 belongs to the threads outside the pool, the main thread, and
+// queue i to worker i. The worker's number is kept in thread-local storage,
+// which reads as 0 on the other threads. One more queue after the workers'
+// holds background jobs, which only workers take
+static job_queue_t* queues = NULL;
+static SDL_TLSID worker_number = 0;
+
+// Threads out of work sleep on work_ready until a job they may take is
+// queued, a counter they wait for reaches zero or the pool shuts down
+static SDL_mutex* pool_mutex = NULL;
+static SDL_cond* work_ready = NULL;
+static SDL_atomic_t num_queued;
+static SDL_atomic_t num_background_queued;
+static SDL_atomic_t num_sleeping;
+static bool is_shutting_down = false;
+
+static void run_job(job_t job);
+
+static int get_worker_number(void) {
+    return (int)(intptr_t)SDL_TLSGet(worker_number);
+}
+
+static void wake_threads(bool all) {
+    if (SDL_AtomicGet(&num_sleeping) == 0) return;
+    SDL_LockMutex(pool_mutex);
+    if (all) {
+        SDL_CondBroadcast(work_ready);
+    } else {
+        SDL_CondSignal(work_ready);
+    }
+    SDL_UnlockMutex(pool_mutex);
+}
+
+// Queue a job on the calling thread's queue; without workers it runs now
+static void push_job(job_t job) {
+    if (num_workers == 0) {
+        run_job(job);
+        return;
+    }
+
+    job_queue_t* queue = &queues[get_worker_number()];
+    SDL_AtomicLock(&queue->lock);
+    if (queue->bottom - queue->top == JOB_QUEUE_SIZE) {
+        SDL_AtomicUnlock(&queue->lock);
+        run_job(job);
+        return;
+    }
+    queue->jobs[queue->bottom % JOB_QUEUE_SIZE] = job;
+    queue->bottom++;
+    SDL_AtomicUnlock(&queue->lock);
+
+    SDL_AtomicAdd(&num_queued, 1);
+    wake_threads(false);
+}
+
+// Whether a job the thread may take is queued
+static bool has_work_for(int number) {
+    return SDL_AtomicGet(&num_queued) > 0 ||
+           (number != 0 && SDL_AtomicGet(&num_background_queued) > 0);
+}
+
+// The oldest background job, for workers only
+static bool take_background_job(int number, job_t* job) {
+    if (number == 0 || SDL_AtomicGet(&num_background_queued) <= 0) {
+        return false;
+    }
+    job_queue_t* queue = &queues[num_workers + 1];
+    SDL_AtomicLock(&queue->lock);
+    bool found = queue->bottom != queue->top;
+    if (found) {
+        *job = queue->jobs[queue->top % JOB_QUEUE_SIZE];
+        queue->top++;
+    }
+    if (queue->top == queue->bottom) {
+        queue->top = 0;
+        queue->bottom = 0;
+    }
+    SDL_AtomicUnlock(&queue->lock);
+    if (found) SDL_AtomicAdd(&num_background_queued, -1);
+    return found;
+}
+
+// The newest job of the thread's own queue, else the oldest of another's,
+// else for workers the oldest background job
+static bool take_job(int number, job_t* job) {
+    if (num_workers == 0) return false;
+    if (SDL_AtomicGet(&num_queued) <= 0) {
+        return take_background_job(number, job);
+    }
+
+    for (int i = 0; i <= num_workers; i++) {
+        job_queue_t* queue = &queues[(number + i) % (num_workers + 1)];
+        SDL_AtomicLock(&queue->lock);
+        bool found = queue->bottom != queue->top;
+        if (found && i == 0) {
+            queue->bottom--;
+            *job = queue->jobs[queue->bottom % JOB_QUEUE_SIZE];
+        } else if (found) {
+            *job = queue->jobs[queue->top % JOB_QUEUE_SIZE];
+            queue->top++;
+        }
+        if (queue->top == queue->bottom) {
+            queue->top = 0;
+            queue->bottom = 0;
+        }
+        SDL_AtomicUnlock(&queue->lock);
+
+        if (found) {
+            SDL_AtomicAdd(&num_queued, -1);
+            return true;
+        }
+    }
+    return take_background_job(number, job);
+}
+
+// Count a job of the counter's group as done, starting the jobs that waited
+// for the group once it is. The count goes down under the counter's lock so
+// wait_for_jobs can tell when the last thread let go of the counter
+static void finish_job(job_counter_t* counter) {
+    if (counter == NULL) return;
+
+    SDL_AtomicLock(&counter->lock);
+    pending_job_t* pending = NULL;
+    bool is_done = SDL_AtomicAdd(&counter->count, -1) == 1;
+    if (is_done) {
+        pending = counter->waiting;
+        counter->waiting = NULL;
+    }
+    SDL_AtomicUnlock(&counter->lock);
+    if (!is_done) return;
+
+    while (pending != NULL) {
+        pending_job_t* next = pending->next;
+        push_job(pending->job);
+        free(pending);
+        pending = next;
+    }
+    wake_threads(true);
+}
+
+static void run_job(job_t job) {
+    // Ranges of several batches leave their upper half to whichever thread
+    // gets to it first, halving again and again as the job goes on
+    while (job.end - job.first > job.batch_size) {
+        int num_batches = (job.end - job.first + job.batch_size - 1) /
+                          job.batch_size;
+        job_t upper = job;
+        upper.first = job.first + num_batches / 2 * job.batch_size;
+        job.end = upper.first;
+        if (upper.counter != NULL) SDL_AtomicAdd(&upper.counter->count, 1);
+        push_job(upper);
+    }
+
+    for (int i = job.first; i < job.end; i++) {
+        job.task(i, job.context);
+    }
+    finish_job(job.counter);
+}
+
+// Sleep until a job the thread may take is queued, the counter (if any) is
+// done or the pool shuts down
+static void wait_for_work(int number, job_counter_t* counter) {
+    SDL_LockMutex(pool_mutex);
+    SDL_AtomicAdd(&num_sleeping, 1);
+    while (!has_work_for(number) && !is_shutting_down &&
+           (counter == NULL || SDL_AtomicGet(&counter->count) > 0)) {
+        SDL_CondWait(work_ready, pool_mutex);
+    }
+    SDL_AtomicAdd(&num_sleeping, -1);
+    SDL_UnlockMutex(pool_mutex);
+}
+
+static int worker_main(void* data) {
+    int number = (int)(intptr_t)data;
+    SDL_TLSSet(worker_number, data, NULL);
+
+    while (true) {
+        job_t job;
+        if (take_job(number, &job)) {
+            run_job(job);
+            continue;
+        }
+        SDL_LockMutex(pool_mutex);
+        bool is_done = is_shutting_down;
+        SDL_UnlockMutex(pool_mutex);
+        if (is_done) return 0;
+        wait_for_work(number, NULL);
+    }
+}
+
+/// @brief start the worker threads; the threads waiting for jobs also run
+/// them, so zero workers means every job runs right away on the thread
+/// adding it, one after the other, which helps debugging
+void init_thread_pool(int worker_count) {
+    if (worker_count < 0) worker_count = 0;
+    if (worker_count > MAX_NUM_WORKERS) worker_count = MAX_NUM_WORKERS;
+    if (worker_count == 0) return;
+
+    pool_mutex = SDL_CreateMutex();
+    work_ready = SDL_CreateCond();
+    SDL_AtomicSet(&num_queued, 0);
+    SDL_AtomicSet(&num_background_queued, 0);
+    SDL_AtomicSet(&num_sleeping, 0);
+    is_shutting_down = false;
+    queues = calloc(worker_count + 2, sizeof(job_queue_t));
+    if (worker_number == 0) worker_number = SDL_TLSCreate();
+
+    // Workers look through every queue from the start, so the count is set
+    // before any of them runs. A worker that fails to start leaves an empty
+    // queue behind
+    num_workers = worker_count;
+    for (int i = 0; i < worker_count; i++) {
+        workers[i] = SDL_CreateThread(worker_main, "worker",
+                                      (void*)(intptr_t)(i + 1));
+        if (workers[i] == NULL) {
+            fprintf(stderr, "Error creating worker thread: %s\n",
+                    SDL_GetError());
+        }
+    }
+}
+
+/// @brief number of threads that execute jobs, including the caller
+int get_thread_pool_size(void) { return num_workers + 1; }
+
+/// @brief run task(task_index, context) on the pool. It counts towards
+/// counter, if not NULL, until it has run, and does not start before after,
+/// if not NULL, is done
+void add_job(thread_pool_task_t task, int task_index, void* context,
+             job_counter_t* counter, job_counter_t* after) {
+    job_t job = {.task = task,
+                 .context = context,
+                 .first = task_index,
+                 .end = task_index + 1,
+                 .batch_size = 1,
+                 .counter = counter};
+    if (counter != NULL) SDL_AtomicAdd(&counter->count, 1);
+
+    if (after != NULL) {
+        SDL_AtomicLock(&after->lock);
+        if (SDL_AtomicGet(&after->count) > 0) {
+            pending_job_t* pending = malloc(sizeof(pending_job_t));
+            pending->job = job;
+            pending->next = after->waiting;
+            after->waiting = pending;
+            SDL_AtomicUnlock(&after->lock);
+            return;
+        }
+        SDL_AtomicUnlock(&after->lock);
+    }
+    push_job(job);
+}
+
+/// @brief run task(task_index, context) on a worker thread, never on a
+/// thread waiting for other jobs, so a long job overlaps with the caller's
+/// work instead of being picked up in the middle of it. It counts towards
+/// counter, if not NULL, until it has run. Without workers it runs now
+void add_background_job(thread_pool_task_t task, int task_index,
+                        void* context, job_counter_t* counter) {
+    job_t job = {.task = task,
+                 .context = context,
+                 .first = task_index,
+                 .end = task_index + 1,
+                 .batch_size = 1,
+                 .counter = counter};
+    if (counter != NULL) SDL_AtomicAdd(&counter->count, 1);
+    if (num_workers == 0) {
+        run_job(job);
+        return;
+    }
+
+    job_queue_t* queue = &queues[num_workers + 1];
+    SDL_AtomicLock(&queue->lock);
+    if (queue->bottom - queue->top == JOB_QUEUE_SIZE) {
+        SDL_AtomicUnlock(&queue->lock);
+        run_job(job);
+        return;
+    }
+    queue->jobs[queue->bottom % JOB_QUEUE_SIZE] = job;
+    queue->bottom++;
+    SDL_AtomicUnlock(&queue->lock);
+
+    // Every sleeper wakes, since the one a signal picks may be a thread
+    // outside the pool
+    SDL_AtomicAdd(&num_background_queued, 1);
+    wake_threads(true);
+}
+
+/// @brief run jobs until every job counted by counter has finished. The
+/// counter can go away as soon as this returns
+void wait_for_jobs(job_counter_t* counter) {
+    int number = num_workers > 0 ? get_worker_number() : 0;
+    while (SDL_AtomicGet(&counter->count) > 0) {
+        job_t job;
+        if (take_job(number, &job)) {
+            run_job(job);
+        } else {
+            wait_for_work(number, counter);
+        }
+    }
+    // The thread that counted down last is done with the counter once it
+    // lets go of the lock
+    SDL_AtomicLock(&counter->lock);
+    SDL_AtomicUnlock(&counter->lock);
+}
+
+/// @brief run task(0..count-1) across the pool and block until all of them
+/// have finished. Threads take the tasks batch_size at a time, in ranges
+/// split in halves for idle threads to steal
+void parallel_for(int count, int batch_size, thread_pool_task_t task,
+                  void* context) {
+    if (count <= 0) return;
+    if (batch_size < 1) batch_size = 1;
+
+    if (num_workers == 0 || count <= batch_size) {
+        for (int i = 0; i < count; i++) {
+            task(i, context);
+        }
+        return;
+    }
+
+    job_counter_t counter = {0};
+    SDL_AtomicSet(&counter.count, 1);
+    run_job((job_t){.task = task,
+                    .context = context,
+                    .first = 0,
+                    .end = count,
+                    .batch_size = batch_size,
+                    .counter = &counter});
+    wait_for_jobs(&counter);
+}
+
+void free_thread_pool(void) {
+    if (num_workers == 0) return;
+
+    SDL_LockMutex(pool_mutex);
+    is_shutting_down = true;
+    SDL_CondBroadcast(work_ready);
+    SDL_UnlockMutex(pool_mutex);
+
+    for (int i = 0; i < num_workers; i++) {
+        if (workers[i] != NULL) SDL_WaitThread(workers[i], NULL);
+    }
+    num_workers = 0;
+
+    free(queues);
+    queues = NULL;
+    SDL_DestroyCond(work_ready);
+    SDL_DestroyMutex(pool_mutex);
+}
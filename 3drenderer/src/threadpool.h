@@ -0,0 +1,32 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <SDL2/SDL.h>
+
+// A task receives its index, in [0, count) for parallel_for, and the shared
+// context pointer
+typedef void (*thread_pool_task_t)(int task_index, void* context);
+
+struct pending_job;
+
+// Jobs of a group still to finish. A counter starts zeroed; each job added
+// with it counts it up, and back down once it has run. Jobs added after it
+// wait until it is back to zero before they start
+typedef struct {
+    SDL_atomic_t count;
+    SDL_SpinLock lock;            // guards waiting and the last count down
+    struct pending_job* waiting;  // jobs to start once count reaches zero
+} job_counter_t;
+
+void init_thread_pool(int num_workers);
+int get_thread_pool_size(void);
+void add_job(thread_pool_task_t task, int task_index, void* context,
+             job_counter_t* counter, job_counter_t* after);
+void add_background_job(thread_pool_task_t task, int task_index,
+                        void* context, job_counter_t* counter);
+void wait_for_jobs(job_counter_t* counter);
+void parallel_for(int count, int batch_size, thread_pool_task_t task,
+                  void* context);
+void free_thread_pool(void);
+
+#endif
@@ -0,0 +1,145 @@
+#include "tile.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "array.h"
+#include "display.h"
+#include "threadpool.h"
+#include "visibility.h"
+
+// Edge steps are at most MAX_RASTER_EXTENT * SUBPIXEL_ONE subpixels times
+// SUBPIXEL_ONE, so raster_setup_triangle accepts every triangle within the
+// guard band when the scissor rect is a tile
+typedef char tile_edge_steps_fit_clamp
+    [(int64_t)MAX_RASTER_EXTENT * SUBPIXEL_ONE * SUBPIXEL_ONE *
+             (2 * TILE_SIZE + SPAN_OVERSHOOT + 1) < EDGE_CLAMP ? 1 : -1];
+
+static tile_t* tiles = NULL;
+static int num_tiles_x = 0;
+static int num_tiles_y = 0;
+
+void init_tiles(int width, int height) {
+    num_tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    num_tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    tiles = (tile_t*)malloc(num_tiles_x * num_tiles_y * sizeof(tile_t));
+
+    for (int ty = 0; ty < num_tiles_y; ty++) {
+        for (int tx = 0; tx < num_tiles_x; tx++) {
+            tile_t* tile = &tiles[ty * num_tiles_x + tx];
+            tile->rect.min_x = tx * TILE_SIZE;
+            tile->rect.min_y = ty * TILE_SIZE;
+            tile->rect.max_x = fmin((tx + 1) * TILE_SIZE, width) - 1;
+            tile->rect.max_y = fmin((ty + 1) * TILE_SIZE, height) - 1;
+            tile->triangle_indices = NULL;
+        }
+    }
+}
+
+/// @brief append every triangle to the bins of the tiles its bounding box
+/// touches; triangles are visited in submission order so each bin keeps that
+/// order and the output stays deterministic
+void bin_triangles_to_tiles(projected_triangle_t* triangles,
+                            int num_triangles) {
+    for (int i = 0; i < num_tiles_x * num_tiles_y; i++) {
+        array_clear(tiles[i].triangle_indices);
+    }
+
+    for (int i = 0; i < num_triangles; i++) {
+        screen_point_t* points = triangles[i].points;
+
+        // Whole pixels around the vertices, conservative against the
+        // rasterizer's subpixel snapping
+        int min_x = floor(fmin(points[0].x, fmin(points[1].x, points[2].x)));
+        int min_y = floor(fmin(points[0].y, fmin(points[1].y, points[2].y)));
+        int max_x = ceil(fmax(points[0].x, fmax(points[1].x, points[2].x)));
+        int max_y = ceil(fmax(points[0].y, fmax(points[1].y, points[2].y)));
+
+        if (max_x < 0 || max_y < 0 || min_x >= get_window_width() ||
+            min_y >= get_window_height()) {
+            continue;
+        }
+
+        int tile_min_x = (min_x < 0 ? 0 : min_x) / TILE_SIZE;
+        int tile_min_y = (min_y < 0 ? 0 : min_y) / TILE_SIZE;
+        int tile_max_x = max_x / TILE_SIZE;
+        int tile_max_y = max_y / TILE_SIZE;
+        if (tile_max_x >= num_tiles_x) tile_max_x = num_tiles_x - 1;
+        if (tile_max_y >= num_tiles_y) tile_max_y = num_tiles_y - 1;
+
+        for (int ty = tile_min_y; ty <= tile_max_y; ty++) {
+            for (int tx = tile_min_x; tx <= tile_max_x; tx++) {
+                array_push(tiles[ty * num_tiles_x + tx].triangle_indices, i);
+            }
+        }
+    }
+}
+
+static void render_tile(int tile_index, void* context) {
+    projected_triangle_t* triangles = (projected_triangle_t*)context;
+    tile_t* tile = &tiles[tile_index];
+
+    if (should_render_visibility_buffer()) {
+        clear_visibility_rect(tile->rect);
+    }
+
+    int num_triangles = array_length(tile->triangle_indices);
+    for (int i = 0; i < num_triangles; i++) {
+        projected_triangle_t* triangle =
+            &triangles[tile->triangle_indices[i]];
+
+        if (should_render_filled_triangles()) {
+            draw_filled_triangle(
+                triangle->points[0].x, triangle->points[0].y,
+                triangle->points[0].w, triangle->points[1].x,
+                triangle->points[1].y, triangle->points[1].w,
+                triangle->points[2].x, triangle->points[2].y,
+                triangle->points[2].w, triangle->color, tile->rect);
+        }
+
+        if (should_render_textured_triangles()) {
+            draw_textured_triangle(
+                triangle->points[0].x, triangle->points[0].y,
+                triangle->points[0].w, triangle->texcoords[0].u,
+                triangle->texcoords[0].v, triangle->points[1].x,
+                triangle->points[1].y, triangle->points[1].w,
+                triangle->texcoords[1].u, triangle->texcoords[1].v,
+                triangle->points[2].x, triangle->points[2].y,
+                triangle->points[2].w, triangle->texcoords[2].u,
+                triangle->texcoords[2].v, triangle->texture,
+                triangle->color, tile->rect);
+        }
+
+        if (should_render_visibility_buffer()) {
+            draw_visibility_triangle(
+                triangle->points[0].x, triangle->points[0].y,
+                triangle->points[0].w, triangle->texcoords[0].u,
+                triangle->texcoords[0].v, triangle->points[1].x,
+                triangle->points[1].y, triangle->points[1].w,
+                triangle->texcoords[1].u, triangle->texcoords[1].v,
+                triangle->points[2].x, triangle->points[2].y,
+                triangle->points[2].w, triangle->texcoords[2].u,
+                triangle->texcoords[2].v, triangle->texture,
+                tile->triangle_indices[i], tile->rect);
+        }
+    }
+
+    // The tile owns its pixels, so it can shade them as soon as its own
+    // depth pass is done
+    if (should_render_visibility_buffer()) {
+        resolve_visibility_rect(triangles, tile->rect);
+    }
+}
+
+/// @brief rasterize the binned triangles, one tile per thread pool task
+void render_tiles(projected_triangle_t* triangles) {
+    parallel_for(num_tiles_x * num_tiles_y, 1, render_tile, triangles);
+}
+
+void free_tiles(void) {
+    for (int i = 0; i < num_tiles_x * num_tiles_y; i++) {
+        array_free(tiles[i].triangle_indices);
+    }
+    free(tiles);
+    tiles = NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include "rasterizer.h"
+#include "triangle.h"
+
+#define TILE_SIZE 64
+
+// A screen tile owns the color and depth pixels inside its rect, so tiles can
+// be rasterized in parallel without any locking
+typedef struct {
+    raster_rect_t rect;
+    int* triangle_indices;  // dynamic array of triangles touching the tile
+} tile_t;
+
+void init_tiles(int width, int height);
+void bin_triangles_to_tiles(projected_triangle_t* triangles,
+                            int num_triangles);
+void render_tiles(projected_triangle_t* triangles);
+void free_tiles(void);
+
+#endif
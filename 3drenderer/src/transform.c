@@ -0,0 +1,186 @@
+#include "transform.h"
+
+#include <SDL2/SDL.h>
+#include <string.h>
+
+#include "array.h"
+
+// Same scheme as the span kernels: SIMD versions get per-function target
+// attributes and are only picked after checking the CPU at run time
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define TRANSFORM_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TRANSFORM_X86 0
+#endif
+
+typedef void (*transform_func_t)(const mat4_t* m, const position_block_t* in,
+                                 vertex_block_t* out, int num_blocks);
+
+int get_num_vertex_blocks(int num_vertices) {
+    return (num_vertices + VERTEX_BLOCK_SIZE - 1) / VERTEX_BLOCK_SIZE;
+}
+
+/// @brief copy positions into blocks, as a dynamic array. The unused lanes of
+/// the last block are zero so the kernels never read garbage
+position_block_t* make_position_blocks(const vec3_t* vertices,
+                                       int num_vertices) {
+    int num_blocks = get_num_vertex_blocks(num_vertices);
+    position_block_t* blocks =
+        array_hold(NULL, num_blocks, sizeof(position_block_t));
+    memset(blocks, 0, num_blocks * sizeof(position_block_t));
+
+    for (int i = 0; i < num_vertices; i++) {
+        position_block_t* block = &blocks[i / VERTEX_BLOCK_SIZE];
+        int lane = i % VERTEX_BLOCK_SIZE;
+        block->x[lane] = vertices[i].x;
+        block->y[lane] = vertices[i].y;
+        block->z[lane] = vertices[i].z;
+    }
+    return blocks;
+}
+
+vec4_t get_block_vertex(const vertex_block_t* blocks, int index) {
+    const vertex_block_t* block = &blocks[index / VERTEX_BLOCK_SIZE];
+    int lane = index % VERTEX_BLOCK_SIZE;
+    vec4_t v = {block->x[lane], block->y[lane], block->z[lane],
+                block->w[lane]};
+    return v;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar kernel, same math and operation order as mat4_mul_vec4 with w = 1
+///////////////////////////////////////////////////////////////////////////////
+static void transform_blocks_scalar(const mat4_t* m, const position_block_t* in,
+                                    vertex_block_t* out, int num_blocks) {
+    for (int b = 0; b < num_blocks; b++) {
+        for (int i = 0; i < VERTEX_BLOCK_SIZE; i++) {
+            float x = in[b].x[i];
+            float y = in[b].y[i];
+            float z = in[b].z[i];
+            out[b].x[i] = m->m[0][0] * x + m->m[0][1] * y + m->m[0][2] * z +
+                          m->m[0][3];
+            out[b].y[i] = m->m[1][0] * x + m->m[1][1] * y + m->m[1][2] * z +
+                          m->m[1][3];
+            out[b].z[i] = m->m[2][0] * x + m->m[2][1] * y + m->m[2][2] * z +
+                          m->m[2][3];
+            out[b].w[i] = m->m[3][0] * x + m->m[3][1] * y + m->m[3][2] * z +
+                          m->m[3][3];
+        }
+    }
+}
+
+static int transform_kernel = TRANSFORM_KERNEL_SCALAR;
+static transform_func_t transform_blocks = transform_blocks_scalar;
+
+#if TRANSFORM_X86
+///////////////////////////////////////////////////////////////////////////////
+// SSE2 kernel, half a block per iteration
+///////////////////////////////////////////////////////////////////////////////
+TARGET_SSE2 static __m128 transform_row_sse2(const float* row, __m128 x,
+                                             __m128 y, __m128 z) {
+    __m128 result = _mm_mul_ps(_mm_set1_ps(row[0]), x);
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(row[1]), y));
+    result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(row[2]), z));
+    return _mm_add_ps(result, _mm_set1_ps(row[3]));
+}
+
+TARGET_SSE2 static void transform_blocks_sse2(const mat4_t* m,
+                                              const position_block_t* in,
+                                              vertex_block_t* out,
+                                              int num_blocks) {
+    for (int b = 0; b < num_blocks; b++) {
+        for (int i = 0; i < VERTEX_BLOCK_SIZE; i += 4) {
+            __m128 x = _mm_loadu_ps(&in[b].x[i]);
+            __m128 y = _mm_loadu_ps(&in[b].y[i]);
+            __m128 z = _mm_loadu_ps(&in[b].z[i]);
+            _mm_storeu_ps(&out[b].x[i], transform_row_sse2(m->m[0], x, y, z));
+            _mm_storeu_ps(&out[b].y[i], transform_row_sse2(m->m[1], x, y, z));
+            _mm_storeu_ps(&out[b].z[i], transform_row_sse2(m->m[2], x, y, z));
+            _mm_storeu_ps(&out[b].w[i], transform_row_sse2(m->m[3], x, y, z));
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2 kernel, a whole block per iteration
+///////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static void transform_blocks_avx2(const mat4_t* m,
+                                              const position_block_t* in,
+                                              vertex_block_t* out,
+                                              int num_blocks) {
+    // Broadcast the matrix once, it stays in registers for the whole batch
+    __m256 rows[4][4];
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 4; c++) {
+            rows[r][c] = _mm256_set1_ps(m->m[r][c]);
+        }
+    }
+
+    for (int b = 0; b < num_blocks; b++) {
+        __m256 x = _mm256_loadu_ps(in[b].x);
+        __m256 y = _mm256_loadu_ps(in[b].y);
+        __m256 z = _mm256_loadu_ps(in[b].z);
+        float* outputs[4] = {out[b].x, out[b].y, out[b].z, out[b].w};
+        for (int r = 0; r < 4; r++) {
+            __m256 result = _mm256_mul_ps(rows[r][0], x);
+            result = _mm256_add_ps(result, _mm256_mul_ps(rows[r][1], y));
+            result = _mm256_add_ps(result, _mm256_mul_ps(rows[r][2], z));
+            _mm256_storeu_ps(outputs[r], _mm256_add_ps(result, rows[r][3]));
+        }
+    }
+}
+#endif
+
+/// @brief pick the widest transform kernel the CPU supports
+void init_transform_kernels(void) {
+    if (!set_transform_kernel(TRANSFORM_KERNEL_AVX2) &&
+        !set_transform_kernel(TRANSFORM_KERNEL_SSE2)) {
+        set_transform_kernel(TRANSFORM_KERNEL_SCALAR);
+    }
+}
+
+/// @brief switch to the given kernel, returns false if the CPU (or the build)
+/// can't run it and keeps the current one
+bool set_transform_kernel(int kernel) {
+    switch (kernel) {
+#if TRANSFORM_X86
+        case TRANSFORM_KERNEL_AVX2:
+            if (!SDL_HasAVX2()) return false;
+            transform_blocks = transform_blocks_avx2;
+            break;
+        case TRANSFORM_KERNEL_SSE2:
+            if (!SDL_HasSSE2()) return false;
+            transform_blocks = transform_blocks_sse2;
+            break;
+#endif
+        case TRANSFORM_KERNEL_SCALAR:
+            transform_blocks = transform_blocks_scalar;
+            break;
+        default:
+            return false;
+    }
+    transform_kernel = kernel;
+    return true;
+}
+
+int get_transform_kernel(void) { return transform_kernel; }
+
+const char* get_transform_kernel_name(void) {
+    switch (transform_kernel) {
+        case TRANSFORM_KERNEL_AVX2:
+            return "AVX2";
+        case TRANSFORM_KERNEL_SSE2:
+            return "SSE2";
+        default:
+            return "scalar";
+    }
+}
+
+/// @brief apply m to every position of num_blocks blocks, with w = 1
+void transform_vertex_blocks(const mat4_t* m, const position_block_t* in,
+                             vertex_block_t* out, int num_blocks) {
+    transform_blocks(m, in, out, num_blocks);
+}
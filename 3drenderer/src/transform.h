@@ -0,0 +1,46 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stdbool.h>
+
+#include "matrix.h"
+#include "vector.h"
+
+// Vertex positions are kept in blocks of VERTEX_BLOCK_SIZE vertices with each
+// coordinate contiguous (AoSoA), so a SIMD register loads one coordinate of a
+// whole block and the matrix is applied to all of them at once
+#define VERTEX_BLOCK_SIZE 8
+
+typedef struct {
+    float x[VERTEX_BLOCK_SIZE];
+    float y[VERTEX_BLOCK_SIZE];
+    float z[VERTEX_BLOCK_SIZE];
+} position_block_t;
+
+// Homogeneous positions after a matrix transform
+typedef struct {
+    float x[VERTEX_BLOCK_SIZE];
+    float y[VERTEX_BLOCK_SIZE];
+    float z[VERTEX_BLOCK_SIZE];
+    float w[VERTEX_BLOCK_SIZE];
+} vertex_block_t;
+
+enum transform_kernel {
+    TRANSFORM_KERNEL_SCALAR,
+    TRANSFORM_KERNEL_SSE2,
+    TRANSFORM_KERNEL_AVX2
+};
+
+void init_transform_kernels(void);
+bool set_transform_kernel(int kernel);
+int get_transform_kernel(void);
+const char* get_transform_kernel_name(void);
+
+int get_num_vertex_blocks(int num_vertices);
+position_block_t* make_position_blocks(const vec3_t* vertices,
+                                       int num_vertices);
+void transform_vertex_blocks(const mat4_t* m, const position_block_t* in,
+                             vertex_block_t* out, int num_blocks);
+vec4_t get_block_vertex(const vertex_block_t* blocks, int index);
+
+#endif
@@ -1,155 +1,167 @@
 #include "triangle.h"
 
 #include "display.h"
-#include "swap.h"
-
-void draw_triangle(int x0, int y0, float z0, float w0, int x1, int y1, float z1,
-                   float w1, int x2, int y2, float z2, float w2,
-                   uint32_t color) {
-    draw_line(x0, y0, z0, w0, x1, y1, z1, w1, color);
-    draw_line(x1, y1, z1, w1, x2, y2, z2, w2, color);
-    draw_line(x2, y2, z2, w2, x0, y0, z0, w0, color);
+#include "rasterizer.h"
+#include "span.h"
+
+void draw_triangle(int x0, int y0, float w0, int x1, int y1, float w1, int x2,
+                   int y2, float w2, uint32_t color) {
+    draw_line(x0, y0, w0, x1, y1, w1, color);
+    draw_line(x1, y1, w1, x2, y2, w2, color);
+    draw_line(x2, y2, w2, x0, y0, w0, color);
 }
 
-void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1,
-                          float z1, float w1, int x2, int y2, float z2,
-                          float w2, uint32_t color) {
-    // 1. Sort the vertices by y-coordinate ascending (y0 < y1 < y2)
-    if (y0 > y1) {
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-        float_swap(&z0, &z1);
-        float_swap(&w0, &w1);
-    }
-    if (y1 > y2) {
-        int_swap(&y1, &y2);
-        int_swap(&x1, &x2);
-        float_swap(&z1, &z2);
-        float_swap(&w1, &w2);
-    }
-    if (y0 > y1) {
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-        float_swap(&z0, &z1);
-        float_swap(&w0, &w1);
-    }
-
-    // Create vector aliases for cleaner barycentric calculation
-    vec2_t point_a = {x0, y0};
-    vec2_t point_b = {x1, y1};
-    vec2_t point_c = {x2, y2};
-
-    float area = (point_b.x - point_a.x) * (point_c.y - point_a.y) -
-                 (point_b.y - point_a.y) * (point_c.x - point_a.x);
-
-    // Safety exit if triangle is too small/degenerate
-    if (fabs(area) < 1.0) {
-        return;
-    }
-
-    // 2. Render the Upper Part (Flat-Bottom)
-    float inv_slope_1 = 0;
-    float inv_slope_2 = 0;
-
-    if (y1 - y0 != 0) inv_slope_1 = (float)(x1 - x0) / abs(y1 - y0);
-    if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
-
-    if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
-            int x_start = x1 + (y - y1) * inv_slope_1;
-            int x_end = x0 + (y - y0) * inv_slope_2;
-
-            if (x_end < x_start) int_swap(&x_start, &x_end);
-
-            for (int x = x_start; x < x_end; x++) {
-                // Calculate Barycentric weights for current pixel (x,y)
-                vec2_t p = {x, y};
-                vec3_t weights =
-                    barycentric_weights(point_a, point_b, point_c, p);
-
-                float alpha = weights.x;
-                float beta = weights.y;
-                float gamma = weights.z;
-
-                // Interpolate the value of 1/w for the current pixel
-                float interpolated_reciprocal_w =
-                    (1 / w0) * alpha + (1 / w1) * beta + (1 / w2) * gamma;
-
-                interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+typedef void (*span_draw_t)(const span_setup_t* setup, int y, int x_start,
+                            int x_end, int e0, int e1, int e2);
+
+// Walk the triangle's bounding box in bands of ZTILE_SIZE rows. Blocks whose
+// farthest stored depth is already closer than the nearest point of the
+// triangle are skipped, and the remaining runs of blocks are handed to the
+// span kernel one row at a time
+static int min_int(int a, int b) { return a < b ? a : b; }
+static int max_int(int a, int b) { return a > b ? a : b; }
+
+static void draw_triangle_spans(const span_setup_t* setup,
+                                span_draw_t draw_span) {
+    raster_rect_t bounds = setup->raster.bounds;
+    const edge_t* edges = setup->raster.edges;
+
+    float min_depth = setup->min_depth;
+
+    int tile_min_x = bounds.min_x / ZTILE_SIZE;
+    int tile_max_x = bounds.max_x / ZTILE_SIZE;
+
+    for (int tile_y = bounds.min_y / ZTILE_SIZE;
+         tile_y <= bounds.max_y / ZTILE_SIZE; tile_y++) {
+        int y_start = max_int(tile_y * ZTILE_SIZE, bounds.min_y);
+        int y_end =
+            min_int(tile_y * ZTILE_SIZE + ZTILE_SIZE - 1, bounds.max_y);
+
+        int tile_x = tile_min_x;
+        while (tile_x <= tile_max_x) {
+            // Skip hidden blocks, then gather a run of potentially visible
+            // ones so each row needs a single span call
+            if (min_depth >= get_ztile_max(tile_x, tile_y)) {
+                tile_x++;
+                continue;
+            }
+            int run_start = tile_x;
+            while (tile_x <= tile_max_x &&
+                   min_depth < get_ztile_max(tile_x, tile_y)) {
+                tile_x++;
+            }
+            int run_end = tile_x - 1;
+
+            int x_start = max_int(run_start * ZTILE_SIZE, bounds.min_x);
+            int x_end =
+                min_int(run_end * ZTILE_SIZE + ZTILE_SIZE - 1, bounds.max_x);
+
+            int e0 = edge_evaluate(edges[0], x_start, y_start);
+            int e1 = edge_evaluate(edges[1], x_start, y_start);
+            int e2 = edge_evaluate(edges[2], x_start, y_start);
+            for (int y = y_start; y <= y_end; y++) {
+                draw_span(setup, y, x_start, x_end, e0, e1, e2);
+                e0 += edges[0].b;
+                e1 += edges[1].b;
+                e2 += edges[2].b;
+            }
 
-                // Only draw pixel if depth is closer than what's in Z-buffer
-                if (interpolated_reciprocal_w < get_zbuffer_at(x, y)) {
-                    draw_pixel(x, y, color);
-                    update_zbuffer_at(x, y, interpolated_reciprocal_w);
-                }
+            // Count the pixels each block may have received
+            int rows = y_end - y_start + 1;
+            for (int i = run_start; i <= run_end; i++) {
+                int block_start = max_int(i * ZTILE_SIZE, x_start);
+                int block_end =
+                    min_int(i * ZTILE_SIZE + ZTILE_SIZE - 1, x_end);
+                add_ztile_writes(i, tile_y,
+                                 (block_end - block_start + 1) * rows);
             }
         }
     }
+}
 
-    // 3. Render the Lower Part (Flat-Top)
-    inv_slope_1 = 0;
-    inv_slope_2 = 0;
-
-    if (y2 - y1 != 0) inv_slope_1 = (float)(x2 - x1) / abs(y2 - y1);
-    if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
-
-    if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
-            int x_start = x1 + (y - y1) * inv_slope_1;
-            int x_end = x0 + (y - y0) * inv_slope_2;
-
-            if (x_end < x_start) int_swap(&x_start, &x_end);
-
-            for (int x = x_start; x < x_end; x++) {
-                // Calculate Barycentric weights for current pixel (x,y)
-                vec2_t p = {x, y};
-                vec3_t weights =
-                    barycentric_weights(point_a, point_b, point_c, p);
-
-                float alpha = weights.x;
-                float beta = weights.y;
-                float gamma = weights.z;
+// Shared triangle setup of every raster path: the edge equations and the
+// planes of 1/w and, when uvs is given, of the perspective-divided texture
+// coordinates. A texture set in the setup gets its mip level picked for the
+// whole triangle. Returns false if there is nothing to draw
+static bool setup_triangle(span_setup_t* setup, const vec4_t points[3],
+                           const tex2_t* uvs, raster_rect_t scissor) {
+    if (!raster_setup_triangle(&setup->raster, vec2_from_vec4(points[0]),
+                               vec2_from_vec4(points[1]),
+                               vec2_from_vec4(points[2]), scissor)) {
+        return false;
+    }
 
-                // Interpolate the value of 1/w
-                float interpolated_reciprocal_w =
-                    (1 / w0) * alpha + (1 / w1) * beta + (1 / w2) * gamma;
+    float inv_w[3];
+    for (int i = 0; i < 3; i++) {
+        inv_w[i] = 1.0 / points[i].w;
+    }
+    setup->inv_w =
+        raster_attribute_plane(&setup->raster, inv_w[0], inv_w[1], inv_w[2]);
+
+    // 1/w is linear in screen space, so the nearest depth is at a vertex
+    setup->min_depth = 1.0 - fmax(inv_w[0], fmax(inv_w[1], inv_w[2]));
+
+    if (uvs != NULL) {
+        // Divide by w once per vertex instead of once per pixel, flipping v
+        // so the texture is not drawn upside down
+        float u_over_w[3];
+        float v_over_w[3];
+        for (int i = 0; i < 3; i++) {
+            u_over_w[i] = uvs[i].u * inv_w[i];
+            v_over_w[i] = (1.0 - uvs[i].v) * inv_w[i];
+        }
+        setup->u_over_w = raster_attribute_plane(&setup->raster, u_over_w[0],
+                                                 u_over_w[1], u_over_w[2]);
+        setup->v_over_w = raster_attribute_plane(&setup->raster, v_over_w[0],
+                                                 v_over_w[1], v_over_w[2]);
+    }
 
-                // Adjust 1/w
-                interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+    if (setup->texture != NULL) {
+        // Texels per pixel over the whole triangle; the edge functions
+        // measure area in subpixel units
+        float screen_area =
+            setup->raster.area / (SUBPIXEL_ONE * SUBPIXEL_ONE);
+        setup->lod = get_texture_lod(setup->texture, uvs, screen_area);
+        setup->filter = get_texture_filter();
 
-                // Z-buffer check
-                if (interpolated_reciprocal_w < get_zbuffer_at(x, y)) {
-                    draw_pixel(x, y, color);
-                    update_zbuffer_at(x, y, interpolated_reciprocal_w);
-                }
-            }
-        }
+        setup->level = select_mip_level(setup->texture, setup->lod);
     }
+    return true;
 }
 
-vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p) {
-    // find the vectors between the vertices ABC and point p
-    vec2_t ac = vec2_sub(c, a);
-    vec2_t ab = vec2_sub(b, a);
-    vec2_t ap = vec2_sub(p, a);
-    vec2_t pc = vec2_sub(c, p);
-    vec2_t pb = vec2_sub(b, p);
+void draw_filled_triangle(float x0, float y0, float w0, float x1, float y1,
+                          float w1, float x2, float y2, float w2,
+                          uint32_t color, raster_rect_t scissor) {
+    vec4_t points[3] = {{x0, y0, 0, w0}, {x1, y1, 0, w1}, {x2, y2, 0, w2}};
 
-    // compute area of parallelogram/triangle ABC using 2d cross product (z = 0)
-    float area_parallelogram_abc = (ac.x * ab.y - ac.y * ab.x);
-
-    // Alpha is area of small parallelogram/triangle PBC divided by full
-    // triangle
-    float alpha = (pc.x * pb.y - pc.y * pb.x) / area_parallelogram_abc;
+    // 1. Set up the edge equations and the 1/w plane once for the triangle
+    span_setup_t setup = {.color = color};
+    if (!setup_triangle(&setup, points, NULL, scissor)) {
+        return;
+    }
 
-    // Beta is triangle APC / ABC
-    float beta = (ac.x * ap.y - ac.y * ap.x) / area_parallelogram_abc;
+    // 2. Walk the potentially visible parts of the bounding box
+    draw_triangle_spans(&setup, draw_fill_span);
+}
 
-    // Gamma is found from alpha + beta + gamma = 1, but its the last area
-    float gamma = 1 - alpha - beta;
+/// @brief first pass of the visibility buffer: depth test the triangle and
+/// record its index and perspective-divided attributes, without touching its
+/// texture
+void draw_visibility_triangle(float x0, float y0, float w0, float u0, float v0,
+                              float x1, float y1, float w1, float u1, float v1,
+                              float x2, float y2, float w2, float u2, float v2,
+                              texture_t* texture, int triangle_index,
+                              raster_rect_t scissor) {
+    vec4_t points[3] = {{x0, y0, 0, w0}, {x1, y1, 0, w1}, {x2, y2, 0, w2}};
+    tex2_t uvs[3] = {{u0, v0}, {u1, v1}, {u2, v2}};
+
+    span_setup_t setup = {.texture = texture,
+                          .triangle_index = triangle_index};
+    if (!setup_triangle(&setup, points, uvs, scissor)) {
+        return;
+    }
 
-    vec3_t weights = {alpha, beta, gamma};
-    return weights;
+    draw_triangle_spans(&setup, draw_visibility_span);
 }
 
 // Helper function to blend texture color with light intensity
@@ -174,172 +186,30 @@ uint32_t modulate_color(uint32_t color_a, uint32_t color_b) {
     return (a_a << 24) | (final_r << 16) | (final_g << 8) | final_b;
 }
 
-// 1. Update draw_texel to accept shading color
-void draw_texel(int x, int y, upng_t* texture, uint32_t shading_color,
-                vec4_t point_a, vec4_t point_b, vec4_t point_c, tex2_t a_uv,
-                tex2_t b_uv, tex2_t c_uv) {
+// 2. Update draw_textured_triangle to accept `color`
+void draw_textured_triangle(float x0, float y0, float w0, float u0, float v0,
+                            float x1, float y1, float w1, float u1, float v1,
+                            float x2, float y2, float w2, float u2, float v2,
+                            texture_t* texture, uint32_t color,
+                            raster_rect_t scissor) {
     if (texture == NULL) return;
 
-    vec2_t p = {x, y};
-    vec2_t a = vec2_from_vec4(point_a);
-    vec2_t b = vec2_from_vec4(point_b);
-    vec2_t c = vec2_from_vec4(point_c);
-
-    vec3_t weights = barycentric_weights(a, b, c, p);
-    float alpha = weights.x;
-    float beta = weights.y;
-    float gamma = weights.z;
-
-    float interpolated_u;
-    float interpolated_v;
-    float interpolated_reciprocal_w;
-
-    interpolated_u = (a_uv.u / point_a.w) * alpha +
-                     (b_uv.u / point_b.w) * beta + (c_uv.u / point_c.w) * gamma;
-    interpolated_v = (a_uv.v / point_a.w) * alpha +
-                     (b_uv.v / point_b.w) * beta + (c_uv.v / point_c.w) * gamma;
-
-    interpolated_reciprocal_w = (1 / point_a.w) * alpha +
-                                (1 / point_b.w) * beta +
-                                (1 / point_c.w) * gamma;
-
-    if (interpolated_reciprocal_w < 0.000001 &&
-        interpolated_reciprocal_w > -0.000001) {
-        interpolated_u = 0;
-        interpolated_v = 0;
-    } else {
-        interpolated_u /= interpolated_reciprocal_w;
-        interpolated_v /= interpolated_reciprocal_w;
-    }
+    vec4_t points[3] = {{x0, y0, 0, w0}, {x1, y1, 0, w1}, {x2, y2, 0, w2}};
+    tex2_t uvs[3] = {{u0, v0}, {u1, v1}, {u2, v2}};
 
-    int texture_width = upng_get_width(texture);
-    int texture_height = upng_get_height(texture);
-
-    int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-    int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
-
-    // Safety checks
-    void* raw_buffer = (void*)upng_get_buffer(texture);
-    if (raw_buffer == NULL) return;
-
-    upng_format format = upng_get_format(texture);
-    uint32_t texture_color = 0xFFFFFFFF;
-    int index = texture_width * tex_y + tex_x;
-
-    // RGB / RGBA Handling
-    if (format == UPNG_RGBA8) {
-        uint32_t* buffer_32 = (uint32_t*)raw_buffer;
-        texture_color = buffer_32[index];
-    } else if (format == UPNG_RGB8) {
-        unsigned char* buffer_8 = (unsigned char*)raw_buffer;
-        int byte_offset = index * 3;
-        uint8_t r = buffer_8[byte_offset];
-        uint8_t g = buffer_8[byte_offset + 1];
-        uint8_t b = buffer_8[byte_offset + 2];
-        texture_color = (0xFF << 24) | (r << 16) | (g << 8) | b;
-    } else {
+    span_setup_t setup = {.color = color, .texture = texture};
+    if (!setup_triangle(&setup, points, uvs, scissor)) {
         return;
     }
 
-    // Apply Lighting!
-    uint32_t final_color = modulate_color(texture_color, shading_color);
-
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
-
-    if (interpolated_reciprocal_w < get_zbuffer_at(x, y)) {
-        draw_pixel(x, y, final_color);
-        update_zbuffer_at(x, y, interpolated_reciprocal_w);
-    }
-}
-
-// 2. Update draw_textured_triangle to accept `color`
-void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0,
-                            float v0, int x1, int y1, float z1, float w1,
-                            float u1, float v1, int x2, int y2, float z2,
-                            float w2, float u2, float v2, upng_t* texture,
-                            uint32_t color) {
-    if (y0 > y1) {
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-        float_swap(&u0, &u1);
-        float_swap(&v0, &v1);
-        float_swap(&z0, &z1);
-        float_swap(&w0, &w1);
-    }
-    if (y1 > y2) {
-        int_swap(&y1, &y2);
-        int_swap(&x1, &x2);
-        float_swap(&u1, &u2);
-        float_swap(&v1, &v2);
-        float_swap(&z1, &z2);
-        float_swap(&w1, &w2);
-    }
-    if (y0 > y1) {
-        int_swap(&y0, &y1);
-        int_swap(&x0, &x1);
-        float_swap(&u0, &u1);
-        float_swap(&v0, &v1);
-        float_swap(&z0, &z1);
-        float_swap(&w0, &w1);
-    }
-
-    v0 = 1.0 - v0;
-    v1 = 1.0 - v1;
-    v2 = 1.0 - v2;
-
-    vec4_t point_a = {x0, y0, z0, w0};
-    vec4_t point_b = {x1, y1, z1, w1};
-    vec4_t point_c = {x2, y2, z2, w2};
-    tex2_t a_uv = {u0, v0};
-    tex2_t b_uv = {u1, v1};
-    tex2_t c_uv = {u2, v2};
-
-    float inv_slope_1 = 0;
-    float inv_slope_2 = 0;
-
-    if (y1 - y0 != 0) inv_slope_1 = (float)(x1 - x0) / abs(y1 - y0);
-    if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
-
-    if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
-            int x_start = x1 + (y - y1) * inv_slope_1;
-            int x_end = x0 + (y - y0) * inv_slope_2;
-
-            if (x_end < x_start) int_swap(&x_start, &x_end);
-
-            for (int x = x_start; x < x_end; x++) {
-                // Pass the color (lighting) to draw_texel
-                draw_texel(x, y, texture, color, point_a, point_b, point_c,
-                           a_uv, b_uv, c_uv);
-            }
-        }
-    }
-
-    inv_slope_1 = 0;
-    inv_slope_2 = 0;
-
-    if (y2 - y1 != 0) inv_slope_1 = (float)(x2 - x1) / abs(y2 - y1);
-    if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
-
-    if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
-            int x_start = x1 + (y - y1) * inv_slope_1;
-            int x_end = x0 + (y - y0) * inv_slope_2;
-
-            if (x_end < x_start) int_swap(&x_start, &x_end);
-
-            for (int x = x_start; x < x_end; x++) {
-                // Pass the color (lighting) to draw_texel
-                draw_texel(x, y, texture, color, point_a, point_b, point_c,
-                           a_uv, b_uv, c_uv);
-            }
-        }
-    }
+    draw_triangle_spans(&setup, draw_texture_span);
 }
 
+/// @brief unit normal of the triangle's plane, pointing out of its front:
+/// the side its corners go around clockwise as seen from, in the engine's
+/// left-handed space. The face planes the back-face tests use are built
+/// from it, see make_face_planes
 vec3_t get_triangle_normal(vec4_t vertices[3]) {
-    // TODO: Check backface culling
-    // Note: We defined Clock-wise vertex numbering for our engine
     // 1. Find vectors B-A and C-A
     vec3_t vector_a = vec3_from_vec4(vertices[0]); /* A   */
     vec3_t vector_b = vec3_from_vec4(vertices[1]); /* / \  */
@@ -1,11 +1,12 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
+#include "rasterizer.h"
 #include "texture.h"
-#include "upng.h"
 #include "vector.h"
 
 typedef struct {
@@ -18,31 +19,44 @@ typedef struct {
     uint32_t color;
 } face_t;
 
+// Clip-space triangle, as clipping splits polygons into
 typedef struct {
     vec4_t points[3];
     tex2_t texcoords[3];
-    uint32_t color;
-    upng_t* texture;
 } triangle_t;
 
-vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p);
+// Screen position of a projected vertex, with the clip-space w the
+// rasterizer interpolates 1 / w from for depth and perspective correction
+typedef struct {
+    float x;
+    float y;
+    float w;
+} screen_point_t;
 
-void draw_triangle(int x0, int y0, float z0, float w0, int x1, int y1, float z1,
-                   float w1, int x2, int y2, float z2, float w2,
-                   uint32_t color);
-void draw_filled_triangle(int x0, int y0, float z0, float w0, int x1, int y1,
-                          float z1, float w1, int x2, int y2, float z2,
-                          float w2, uint32_t color);
+// Projected triangle, only what the rasterizer reads of it
+typedef struct {
+    screen_point_t points[3];
+    tex2_t texcoords[3];
+    uint32_t color;
+    texture_t* texture;  // NULL for flat shading
+} projected_triangle_t;
 
-void draw_texel(int x, int y, upng_t* texture, uint32_t shading_color,
-                vec4_t point_a, vec4_t point_b, vec4_t point_c, tex2_t a_uv,
-                tex2_t b_uv, tex2_t c_uv);
+void draw_triangle(int x0, int y0, float w0, int x1, int y1, float w1, int x2,
+                   int y2, float w2, uint32_t color);
+void draw_filled_triangle(float x0, float y0, float w0, float x1, float y1,
+                          float w1, float x2, float y2, float w2,
+                          uint32_t color, raster_rect_t scissor);
+void draw_visibility_triangle(float x0, float y0, float w0, float u0, float v0,
+                              float x1, float y1, float w1, float u1, float v1,
+                              float x2, float y2, float w2, float u2, float v2,
+                              texture_t* texture, int triangle_index,
+                              raster_rect_t scissor);
 
-void draw_textured_triangle(int x0, int y0, float z0, float w0, float u0,
-                            float v0, int x1, int y1, float z1, float w1,
-                            float u1, float v1, int x2, int y2, float z2,
-                            float w2, float u2, float v2, upng_t* texture,
-                            uint32_t color);
+void draw_textured_triangle(float x0, float y0, float w0, float u0, float v0,
+                            float x1, float y1, float w1, float u1, float v1,
+                            float x2, float y2, float w2, float u2, float v2,
+                            texture_t* texture, uint32_t color,
+                            raster_rect_t scissor);
 
 vec3_t get_triangle_normal(vec4_t vertices[3]);
 uint32_t modulate_color(uint32_t color_a, uint32_t color_b);
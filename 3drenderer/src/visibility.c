@@ -0,0 +1,62 @@
+#include "visibility.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "display.h"
+
+static visibility_sample_t* visibility_buffer = NULL;
+static int buffer_width = 0;
+
+void init_visibility_buffer(int width, int height) {
+    buffer_width = width;
+    visibility_buffer = (visibility_sample_t*)malloc(
+        width * height * sizeof(visibility_sample_t));
+}
+
+visibility_sample_t* get_visibility_buffer(void) { return visibility_buffer; }
+
+void clear_visibility_rect(raster_rect_t rect) {
+    for (int y = rect.min_y; y <= rect.max_y; y++) {
+        for (int x = rect.min_x; x <= rect.max_x; x++) {
+            visibility_buffer[buffer_width * y + x].triangle_index = -1;
+        }
+    }
+}
+
+/// @brief second pass of the visibility buffer: shade every covered pixel of
+/// the rect exactly once, with the triangle that won the depth test
+void resolve_visibility_rect(projected_triangle_t* triangles,
+                             raster_rect_t rect) {
+    for (int y = rect.min_y; y <= rect.max_y; y++) {
+        for (int x = rect.min_x; x <= rect.max_x; x++) {
+            visibility_sample_t sample =
+                visibility_buffer[buffer_width * y + x];
+            if (sample.triangle_index < 0) continue;
+
+            projected_triangle_t* triangle =
+                &triangles[sample.triangle_index];
+
+            float u = 0;
+            float v = 0;
+            if (fabs(sample.inv_w) >= 0.000001) {
+                float w = 1 / sample.inv_w;
+                u = sample.u_over_w * w;
+                v = sample.v_over_w * w;
+            }
+
+            // Triangles without a usable texture keep their flat shading
+            uint32_t texture_color = 0xFFFFFFFF;
+            if (triangle->texture != NULL) {
+                texture_color =
+                    sample_texture(triangle->texture, u, v, sample.lod);
+            }
+            draw_pixel(x, y, modulate_color(texture_color, triangle->color));
+        }
+    }
+}
+
+void free_visibility_buffer(void) {
+    free(visibility_buffer);
+    visibility_buffer = NULL;
+}
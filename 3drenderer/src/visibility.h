@@ -0,0 +1,24 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include "rasterizer.h"
+#include "triangle.h"
+
+// What the first pass of the visibility buffer stores for every pixel: the
+// closest triangle and its perspective-divided attributes at the pixel
+typedef struct {
+    int triangle_index;  // -1 when no triangle covers the pixel
+    float inv_w;
+    float u_over_w;
+    float v_over_w;
+    float lod;
+} visibility_sample_t;
+
+void init_visibility_buffer(int width, int height);
+visibility_sample_t* get_visibility_buffer(void);
+void clear_visibility_rect(raster_rect_t rect);
+void resolve_visibility_rect(projected_triangle_t* triangles,
+                             raster_rect_t rect);
+void free_visibility_buffer(void);
+
+#endif